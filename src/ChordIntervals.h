@@ -0,0 +1,53 @@
+////////////////////////////////////////////////////////////
+//
+// LE STRUM - CHORD INTERVALS
+//
+// GENERATED FILE - DO NOT EDIT. Made by host/genchords.c
+// from the reference interval lists (make intervals)
+//
+// The masks have bit n set for the note n semitones above
+// the root and are 2 bytes per entry, high byte first. See
+// stackTriads() for how they are put together
+//
+////////////////////////////////////////////////////////////
+#ifndef CHORD_INTERVALS_H
+#define CHORD_INTERVALS_H
+
+// By chord type, the intervals of the chord
+rom char *chordIntervals = 
+	"\x00\x91"	// none (as maj): 0 4 7
+	"\x00\x91"	// maj: 0 4 7
+	"\x00\x89"	// min: 0 3 7
+	"\x00\x49"	// dim: 0 3 6
+	"\x04\x91"	// dom7: 0 4 7 10
+	"\x08\x91"	// maj7: 0 4 7 11
+	"\x04\x89"	// min7: 0 3 7 10
+	"\x01\x11"	// aug: 0 4 8
+;
+
+// By chord type, the 7th added by EXT_9TH
+rom char *chordSevenths = 
+	"\x04\x00"	// none (as maj): 10
+	"\x04\x00"	// maj: 10
+	"\x04\x00"	// min: 10
+	"\x02\x00"	// dim: 9
+	"\x04\x00"	// dom7: 10
+	"\x08\x00"	// maj7: 11
+	"\x04\x00"	// min7: 10
+	"\x04\x00"	// aug: 10
+;
+
+// By extension, intervals to clear, intervals to add and a
+// mask for the 7th
+rom char *chordExtensions = 
+	"\x00\x00\x00\x00\x00\x00"	// none: clear -, add -
+	"\x00\x18\x00\x20\x00\x00"	// sus4 (3rd to 4th): clear 3 4, add 5
+	"\x00\x00\x02\x00\x00\x00"	// add6: clear -, add 9
+	"\x00\x00\x00\x04\x00\x00"	// add9 (as 2nd): clear -, add 2
+	"\x00\x18\x00\x04\x00\x00"	// sus2 (3rd to 2nd): clear 3 4, add 2
+	"\x00\x00\x00\x20\x00\x00"	// add11 (as 4th): clear -, add 5
+	"\x00\x00\x00\x04\xff\xff"	// 9th (7th and 2nd): clear -, add 2, 7th
+	"\x01\x80\x00\x40\x00\x00"	// flat 5: clear 7 8, add 6
+;
+
+#endif // CHORD_INTERVALS_H
@@ -0,0 +1,180 @@
+////////////////////////////////////////////////////////////
+//
+// LE STRUM - GUITAR CHORD VOICINGS
+//
+// GENERATED FILE - DO NOT EDIT. Made by host/genvoicings.c
+// from the reference chord shapes (make voicings)
+//
+// There is a table for each chord extension so that none
+// is over 256 bytes. Each has 6 notes, low string first,
+// for each root of the major, minor and dom7 chords, with
+// NO_NOTE for unplayed strings. guitarBassStrings flags the
+// strings that only sound with OPT_GUITARBASSNOTES
+//
+////////////////////////////////////////////////////////////
+#ifndef GUITAR_VOICINGS_H
+#define GUITAR_VOICINGS_H
+
+rom char *guitarVoicingsNone = 
+	"\x2b\x30\x34\x37\x3c\x40"	// C major
+	"\x2c\x31\x38\x3d\x41\x44"	// C# major
+	"\xff\x2d\x32\x39\x3e\x42"	// D major
+	"\x2e\x33\x3a\x3f\x43\x46"	// D# major
+	"\x28\x2f\x34\x38\x3b\x40"	// E major
+	"\x29\x30\x35\x39\x3c\x41"	// F major
+	"\x2a\x31\x36\x3a\x3d\x42"	// F# major
+	"\x2b\x2f\x32\x37\x3b\x43"	// G major
+	"\x2c\x33\x38\x3c\x3f\x44"	// G# major
+	"\x28\x2d\x34\x39\x3d\x40"	// A major
+	"\x29\x2e\x35\x3a\x3e\x41"	// A# major
+	"\x2a\x2f\x36\x3b\x3f\x42"	// B major
+	"\x2b\x30\x37\x3c\x3f\x43"	// C minor
+	"\x2c\x31\x38\x3d\x40\x44"	// C# minor
+	"\xff\x2d\x32\x39\x3e\x41"	// D minor
+	"\x2e\x33\x3a\x3f\x42\x46"	// D# minor
+	"\x28\x2f\x34\x37\x3b\x40"	// E minor
+	"\x29\x30\x35\x38\x3c\x41"	// F minor
+	"\x2a\x31\x36\x39\x3d\x42"	// F# minor
+	"\x2b\x32\x37\x3a\x3e\x43"	// G minor
+	"\x2c\x33\x38\x3b\x3f\x44"	// G# minor
+	"\x28\x2d\x34\x39\x3c\x40"	// A minor
+	"\x29\x2e\x35\x3a\x3d\x41"	// A# minor
+	"\x2a\x2f\x36\x3b\x3e\x42"	// B minor
+	"\x2b\x30\x34\x3a\x3c\x40"	// C dom7
+	"\x2c\x31\x38\x3b\x41\x44"	// C# dom7
+	"\xff\x2d\x32\x39\x3c\x42"	// D dom7
+	"\x2e\x33\x3a\x3d\x43\x46"	// D# dom7
+	"\x28\x2f\x32\x38\x3b\x40"	// E dom7
+	"\x29\x30\x33\x39\x3c\x41"	// F dom7
+	"\x2a\x31\x34\x3a\x3d\x42"	// F# dom7
+	"\x2b\x32\x35\x3b\x3e\x43"	// G dom7
+	"\x2c\x33\x36\x3c\x3f\x44"	// G# dom7
+	"\x28\x2d\x34\x37\x3d\x40"	// A dom7
+	"\x29\x2e\x35\x38\x3e\x41"	// A# dom7
+	"\x2a\x2f\x36\x39\x3f\x42"	// B dom7
+;
+
+rom char *guitarVoicingsSus4 = 
+	"\x2b\x30\x35\x37\x3c\x41"	// C major
+	"\x2c\x31\x38\x3d\x42\x44"	// C# major
+	"\xff\x2d\x32\x39\x3e\x43"	// D major
+	"\x2e\x33\x3a\x3f\x44\x46"	// D# major
+	"\x28\x2f\x34\x39\x3b\x40"	// E major
+	"\x29\x30\x35\x3a\x3c\x41"	// F major
+	"\x2a\x31\x36\x3b\x3d\x42"	// F# major
+	"\x2b\x30\x32\x37\x3c\x43"	// G major
+	"\x2c\x33\x38\x3d\x3f\x44"	// G# major
+	"\x28\x2d\x34\x39\x3e\x40"	// A major
+	"\x29\x2e\x35\x3a\x3f\x41"	// A# major
+	"\x2a\x2f\x36\x3b\x40\x42"	// B major
+	"\x2b\x30\x37\x3c\x41\x43"	// C minor
+	"\x2c\x31\x38\x3d\x42\x44"	// C# minor
+	"\xff\x2d\x32\x39\x3e\x43"	// D minor
+	"\x2e\x33\x3a\x3f\x44\x46"	// D# minor
+	"\x28\x2f\x34\x39\x3b\x40"	// E minor
+	"\x29\x30\x35\x3a\x3c\x41"	// F minor
+	"\x2a\x31\x36\x3b\x3d\x42"	// F# minor
+	"\x2b\x32\x37\x3c\x3e\x43"	// G minor
+	"\x2c\x33\x38\x3d\x3f\x44"	// G# minor
+	"\x28\x2d\x34\x39\x3e\x40"	// A minor
+	"\x29\x2e\x35\x3a\x3f\x41"	// A# minor
+	"\x2a\x2f\x36\x3b\x40\x42"	// B minor
+	"\x2b\x30\x35\x3a\x3c\x41"	// C dom7
+	"\x2c\x31\x38\x3b\x42\x44"	// C# dom7
+	"\xff\x2d\x32\x39\x3c\x43"	// D dom7
+	"\x2e\x33\x3a\x3d\x44\x46"	// D# dom7
+	"\x28\x2f\x32\x39\x3b\x40"	// E dom7
+	"\x29\x30\x33\x3a\x3c\x41"	// F dom7
+	"\x2a\x31\x34\x3b\x3d\x42"	// F# dom7
+	"\x2b\x32\x35\x3c\x3e\x43"	// G dom7
+	"\x2c\x33\x36\x3d\x3f\x44"	// G# dom7
+	"\x28\x2d\x34\x37\x3e\x40"	// A dom7
+	"\x29\x2e\x35\x38\x3f\x41"	// A# dom7
+	"\x2a\x2f\x36\x39\x40\x42"	// B dom7
+;
+
+rom char *guitarVoicingsAdd6 = 
+	"\x2b\x30\x34\x39\x3c\x40"	// C major
+	"\x2c\x31\x3a\x3d\x41\x44"	// C# major
+	"\xff\x2d\x32\x3b\x3e\x42"	// D major
+	"\x2e\x33\x3c\x3f\x43\x46"	// D# major
+	"\x28\x2f\x34\x38\x3d\x40"	// E major
+	"\x29\x30\x35\x39\x3e\x41"	// F major
+	"\x2a\x31\x36\x3a\x3f\x42"	// F# major
+	"\x2b\x2f\x34\x37\x3b\x43"	// G major
+	"\x2c\x33\x38\x3c\x41\x44"	// G# major
+	"\x28\x2d\x36\x39\x3d\x40"	// A major
+	"\x29\x2e\x37\x3a\x3e\x41"	// A# major
+	"\x2a\x2f\x38\x3b\x3f\x42"	// B major
+	"\x2b\x30\x39\x3c\x3f\x43"	// C minor
+	"\x2c\x31\x3a\x3d\x40\x44"	// C# minor
+	"\xff\x2d\x32\x3b\x3e\x41"	// D minor
+	"\x2e\x33\x3c\x3f\x42\x46"	// D# minor
+	"\x28\x2f\x34\x37\x3d\x40"	// E minor
+	"\x29\x30\x35\x38\x3e\x41"	// F minor
+	"\x2a\x31\x36\x39\x3f\x42"	// F# minor
+	"\x2b\x32\x37\x3a\x40\x43"	// G minor
+	"\x2c\x33\x38\x3b\x41\x44"	// G# minor
+	"\x28\x2d\x36\x39\x3c\x40"	// A minor
+	"\x29\x2e\x37\x3a\x3d\x41"	// A# minor
+	"\x2a\x2f\x38\x3b\x3e\x42"	// B minor
+	"\x2b\x30\x34\x39\x3c\x40"	// C dom7
+	"\x2c\x31\x3a\x3b\x41\x44"	// C# dom7
+	"\xff\x2d\x32\x3b\x3c\x42"	// D dom7
+	"\x2e\x33\x3c\x3d\x43\x46"	// D# dom7
+	"\x28\x2f\x32\x38\x3d\x40"	// E dom7
+	"\x29\x30\x33\x39\x3e\x41"	// F dom7
+	"\x2a\x31\x34\x3a\x3f\x42"	// F# dom7
+	"\x2b\x32\x35\x3b\x40\x43"	// G dom7
+	"\x2c\x33\x36\x3c\x41\x44"	// G# dom7
+	"\x28\x2d\x36\x37\x3d\x40"	// A dom7
+	"\x29\x2e\x37\x38\x3e\x41"	// A# dom7
+	"\x2a\x2f\x38\x39\x3f\x42"	// B dom7
+;
+
+rom char *guitarVoicingsAdd9 = 
+	"\x2b\x30\x34\x37\x3e\x40"	// C major
+	"\x2c\x31\x38\x3f\x41\x44"	// C# major
+	"\xff\x2d\x32\x39\x3e\x40"	// D major
+	"\x2e\x33\x3a\x41\x43\x46"	// D# major
+	"\x28\x2f\x36\x38\x3b\x40"	// E major
+	"\x29\x30\x37\x39\x3c\x41"	// F major
+	"\x2a\x31\x38\x3a\x3d\x42"	// F# major
+	"\x2b\x2f\x32\x39\x3b\x43"	// G major
+	"\x2c\x33\x3a\x3c\x3f\x44"	// G# major
+	"\x28\x2d\x34\x3b\x3d\x40"	// A major
+	"\x29\x2e\x35\x3c\x3e\x41"	// A# major
+	"\x2a\x2f\x36\x3d\x3f\x42"	// B major
+	"\x2b\x30\x37\x3e\x3f\x43"	// C minor
+	"\x2c\x31\x38\x3f\x40\x44"	// C# minor
+	"\xff\x2d\x32\x39\x3e\x40"	// D minor
+	"\x2e\x33\x3a\x41\x42\x46"	// D# minor
+	"\x28\x2f\x36\x37\x3b\x40"	// E minor
+	"\x29\x30\x37\x38\x3c\x41"	// F minor
+	"\x2a\x31\x38\x39\x3d\x42"	// F# minor
+	"\x2b\x32\x39\x3a\x3e\x43"	// G minor
+	"\x2c\x33\x3a\x3b\x3f\x44"	// G# minor
+	"\x28\x2d\x34\x3b\x3c\x40"	// A minor
+	"\x29\x2e\x35\x3c\x3d\x41"	// A# minor
+	"\x2a\x2f\x36\x3d\x3e\x42"	// B minor
+	"\x2b\x30\x34\x3a\x3e\x40"	// C dom7
+	"\x2c\x31\x38\x3f\x41\x44"	// C# dom7
+	"\xff\x2d\x32\x39\x3c\x40"	// D dom7
+	"\x2e\x33\x3a\x41\x43\x46"	// D# dom7
+	"\x28\x2f\x36\x38\x3b\x40"	// E dom7
+	"\x29\x30\x37\x39\x3c\x41"	// F dom7
+	"\x2a\x31\x38\x3a\x3d\x42"	// F# dom7
+	"\x2b\x32\x39\x3b\x3e\x43"	// G dom7
+	"\x2c\x33\x3a\x3c\x3f\x44"	// G# dom7
+	"\x28\x2d\x34\x3b\x3d\x40"	// A dom7
+	"\x29\x2e\x35\x3c\x3e\x41"	// A# dom7
+	"\x2a\x2f\x36\x3d\x3f\x42"	// B dom7
+;
+
+rom char *guitarBassStrings = 
+	"\x01\x01\x02\x01\x00\x00\x00\x00\x00\x01\x01\x01"	// major
+	"\x01\x01\x02\x01\x00\x00\x00\x00\x00\x01\x01\x01"	// minor
+	"\x01\x01\x02\x01\x00\x00\x00\x00\x00\x01\x01\x01"	// dom7
+;
+
+#endif // GUITAR_VOICINGS_H
@@ -35,27 +35,19 @@
 ////////////////////////////////////////////////////////////
 
 // INCLUDE FILES
-#include <system.h>
-#include <memory.h>
-#include <eeprom.h>
+#include "StrumHAL.h"
+#include "GuitarVoicings.h"
+#include "ChordIntervals.h"
 
 // PIC CONFIG
+#ifndef STRUM_HOST
 #pragma DATA _CONFIG1, _FOSC_INTOSC & _WDTE_OFF & _MCLRE_OFF &_CLKOUTEN_OFF
 #pragma DATA _CONFIG2, _WRT_OFF & _PLLEN_OFF & _STVREN_ON & _BORV_19 & _LVP_OFF
 #pragma CLOCK_FREQ 8000000
+#endif
 
-// Define pins
-#define P_CLK 			porta.2
-#define P_DS 			portc.0
-#define P_STYLUS 		portc.1
-#define P_LED 			portc.2
-#define P_KEYS1	 		porta.5
-#define P_KEYS2	 		porta.4
-#define P_KEYS3	 		portc.3
-#define P_MODE	 		portc.5
-//portc.4 = TX
-
-// special EEPROM addresses
+// special EEPROM addresses. 0-7 hold the settings as saved by
+// firmware before the journal, and are only read now
 #define EEPROM_ADDR_MAGIC_COOKIE 	0
 #define EEPROM_ADDR_OPTIONS_HIGH 	1
 #define EEPROM_ADDR_OPTIONS_LOW 	2
@@ -64,10 +56,23 @@
 #define EEPROM_ADDR_PLAY_CHANNEL 	5
 #define EEPROM_ADDR_DRONE_CHANNEL 	6
 #define EEPROM_ADDR_DRONE_OCTAVE 	7
+#define EEPROM_ADDR_SETTLE_COOKIE 	8
+#define EEPROM_ADDR_SCALE_COOKIE 	9
+#define EEPROM_ADDR_STRING_SETTLE 	16	// 16 bytes
+#define EEPROM_ADDR_KEY_SETTLE 		32	// 16 bytes
+#define EEPROM_ADDR_SCALES 			48	// SCALE_SLOTS masks, high byte first
+#define EEPROM_ADDR_PRESETS 		72	// PRESET_SLOTS records
+#define EEPROM_ADDR_JOURNAL 		192	// JOURNAL_SLOTS records
 
 // special token used to indicate initialised eeprom
 #define EEPROM_MAGIC_COOKIE 		154
 
+// special token used to indicate a stored settle time calibration
+#define EEPROM_SETTLE_COOKIE 		155
+
+// special token used to indicate that the scale bank is filled
+#define EEPROM_SCALE_COOKIE 		156
+
 // CHORD SHAPES
 enum {
 	CHORD_NONE 	= 0b000,
@@ -101,7 +106,11 @@ enum {
 	ADD_NONE,
 	SUS_4,
 	ADD_6,
-	ADD_9
+	ADD_9,
+	SUS_2,
+	ADD_11,
+	EXT_9TH,	// 7th and 9th
+	FLAT_5
 };
 
 // CONTROLLING FLAGS
@@ -118,7 +127,7 @@ enum {
 	OPT_SUSTAINCOMMON		= 0x0200, // when switching to a new chord, allow common notes to sustain (do not retrig) on strings
 	OPT_SUSTAINDRONE		= 0x0400, // do not kill drone chord when chord button is released
 	OPT_SUSTAINDRONECOMMON	= 0x0800, // when switching to a new chord, allow common notes to sustain (do not retrig) on drone chord
-	OPT_ADDNOTES			= 0x1000, // enable adding of sus4, add6, add9 to chord
+	OPT_ADDNOTES			= 0x1000, // enable chord extensions (sus4, add6, add9, sus2, add11, 9th, flat 5)
 	OPT_CHROMATIC			= 0x2000, // map strings to chromatic scale from C instead of chord
 	OPT_DIATONIC			= 0x4000, // map strings to diatonic major scale 
 	OPT_PENTATONIC			= 0x8000  // map strings to pentatonic scale 
@@ -126,15 +135,25 @@ enum {
 
 enum {
 	SETTING_REVERSESTRUM	= 0x0001, // reverse strum direction
-	SETTING_CIRCLEOF5THS	= 0x0002  // accordion button layout
+	SETTING_CIRCLEOF5THS	= 0x0002, // accordion button layout
+	SETTING_VELOCITY_CURVE	= 0x000c, // 2 bits, strum speed to velocity curve (0 = off)
+	SETTING_SCALE			= 0x00f0, // 4 bits, scale bank slot + 1 mapped to strings (0 = off)
+	SETTING_ARP				= 0x0f00  // 4 bits, arpeggiator rate (0 = off)
 };
+#define SETTING_VELOCITY_CURVE_SHIFT 2
+#define SETTING_SCALE_SHIFT 4
+#define SETTING_ARP_SHIFT 8
 
 enum {
 	SHIFTMODE_NONE = 0,
 	SHIFTMODE_PLAYCHANNEL = 1,
 	SHIFTMODE_DRONECHANNEL = 2,
 	SHIFTMODE_DRONEOCTAVE = 3,
-	SHIFTMODE_DRONEKEYS = 4
+	SHIFTMODE_DRONEKEYS = 4,
+	SHIFTMODE_SCALE = 5,
+	SHIFTMODE_ARP = 6,
+	SHIFTMODE_RECALL = 7,
+	SHIFTMODE_STORE = 8
 };
 
 //defaults
@@ -154,12 +173,16 @@ typedef struct
 	byte extension; // added note if applicable
 } CHORD_SELECTION;
 
+// A set of MIDI notes, one bit per note
+typedef struct
+{
+	byte bits[16];
+} NOTESET;
+
 // special note value
 #define NO_NOTE 0xff
 #define NO_SELECTION 0xff
 
-// bit mapped register of which strings are currently connected to the stylus 
-unsigned long strings =0;
 
 // The first column containing a pressed chord button 
 byte rootNoteColumn = NO_SELECTION;
@@ -167,15 +190,40 @@ byte rootNoteColumn = NO_SELECTION;
 // The first column containing a pressed chord button during the last key scan
 byte lastRootNoteColumn = NO_SELECTION;
 
-// Define the information relating to string play
+// Debounced chord buttons, one bit per column in each row, and
+// MODE as bit 0 of a fourth row so that it stays in step with
+// them. A button changes state once it has read the other way in
+// KEY_DEBOUNCE key scans in a row (1 to 3). The scans are counted
+// for all the buttons of a row at once, in two bit planes
+#define KEY_DEBOUNCE 2
+#define KEY_ROW_MODE 3
+unsigned int keyState[4];
+unsigned int keyCount0[4];		// low bit of each button's count
+unsigned int keyCount1[4];		// ..and high bit
+#define KEY_DEBOUNCE_PLANE(b) ((KEY_DEBOUNCE & (b))? 0xffff : 0)
+
+// Define the information relating to string play. The state of
+// each string is kept together in one structure
+typedef struct
+{
+	byte notes[16];			// note mapped to each string, NO_NOTE if none
+	NOTESET chord;			// the same notes as a set
+	unsigned int touched;	// bit per string, set while the stylus is on it
+} STRING_STATE;
 byte playVelocity = 127;
-byte playNotes[16];
+STRING_STATE playStrings;
 
 // Define the information relating to chord button drone
 byte droneVelocity = 127;
-byte droneNotes[16];
+NOTESET droneNotes;
 unsigned int droneKeys = 0; 
 
+// Notes we have started and not yet stopped by the play layer
+// (strings and chord) and the drone layer. They are kept by
+// layer rather than channel since both can use the same one
+NOTESET playSounding;
+NOTESET droneSounding;
+
 // Shift mode
 byte shiftMode = SHIFTMODE_NONE;
 byte ledToggle = 0;
@@ -184,6 +232,353 @@ byte ledToggle = 0;
 // detected if it has changed
 CHORD_SELECTION lastChordSelection = { CHORD_NONE, NO_NOTE, ADD_NONE };
 
+// Cache of recently played chords, so that moving between the
+// same few chords does not have to work out the notes each time
+#define CHORD_CACHE_SIZE 4
+typedef struct 
+{
+	CHORD_SELECTION chord;	// CHORD_NONE if the entry is empty
+	byte age;				// 0 for the most recently used
+	byte notes[16];			// notes mapped to the strings
+	NOTESET drone;			// notes of the drone chord
+} CHORD_CACHE_ENTRY;
+CHORD_CACHE_ENTRY chordCache[CHORD_CACHE_SIZE];
+
+// The cache is only good for these values
+unsigned int chordCacheOptions = 0;
+unsigned int chordCacheScale = 0;
+byte chordCacheDroneOctave = 0;
+unsigned int chordCacheDroneKeys = 0;
+
+// Cache statistics
+unsigned int chordCacheHits = 0;
+unsigned int chordCacheMisses = 0;
+
+// MIDI transmit queues, filled with whole messages and drained by
+// the USART interrupt. Between messages the interrupt takes the
+// next one from the most urgent queue that has one, so a string
+// plucked during a chord change is not stuck behind the change's
+// note offs. Once a SysEx has started it is sent to the end
+// before anything else. Each queue has only the room its
+// traffic needs and its size must be a power of 2. TXQ_THRU
+// only fills while a message of ours is going out, TXQ_STRING
+// takes 10 notes, more than a fast strum starts in one frame,
+// and TXQ_OTHER a whole stats or trace message. TXQ_DRONE and
+// TXQ_OTHER also take 10 notes, so a chord change with more
+// notes than that to start or stop waits for the interrupt to
+// make room (the panic is sent in parts instead)
+enum {
+	TXQ_THRU,		// messages from MIDI in (filled by the interrupt)
+	TXQ_STRING,		// string note ons
+	TXQ_DRONE,		// drone note ons
+	TXQ_OTHER,		// note offs and everything else, in order
+	TXQ_COUNT
+};
+#ifdef MIDI_IN
+#define TXQ_THRU_SIZE 32
+#else
+#define TXQ_THRU_SIZE 1			// never filled
+#endif
+#define TXQ_STRING_SIZE 32
+#define TXQ_DRONE_SIZE 32
+#define TXQ_OTHER_SIZE 32
+byte txBuffer[TXQ_THRU_SIZE + TXQ_STRING_SIZE + TXQ_DRONE_SIZE + TXQ_OTHER_SIZE];
+byte txBase[TXQ_COUNT];				// where each queue starts in txBuffer
+byte txMask[TXQ_COUNT];				// ..and its size - 1
+volatile byte txHead[TXQ_COUNT];	// next free position (written by txCommit)
+volatile byte txTail[TXQ_COUNT];	// next byte to transmit (written by ISR)
+volatile byte txQueue = 0;			// queue of the message being sent
+volatile byte txRemain = 0;			// data bytes left in it
+volatile byte txSysex = 0;			// a SysEx is being sent
+
+// A note on must not overtake a note off (or anything else) for
+// the same note that is still queued. Notes stopped since the
+// TXQ_OTHER queue was last empty are kept here, and a note on for
+// one of them is queued behind it. txOrderAll does the same for
+// every note when a control change has been queued
+NOTESET txOffPending;
+byte txOrderAll = 0;
+
+// Transmit queue statistics for sizing the queues
+unsigned int txOverflows = 0;	// times a queue had to wait for space
+byte txHighWater = 0;			// most bytes ever waiting in all queues
+
+// MIDI running status, applied by the interrupt as messages go
+// out. The status byte is sent again after this many messages 
+// even if it has not changed, so that a receiver which missed
+// it (e.g. plugged in mid song) picks it up again. Set to 0 to 
+// only send the status byte when it changes
+#define MIDI_STATUS_REFRESH 16
+volatile byte runningStatus = 0;	// last status byte sent, 0 if none
+volatile byte runningStatusCount = 0;	// messages left before status is resent
+
+// MIDI in is merged into the output when built with MIDI_IN
+// defined (the stock board has no MIDI in circuit, so RA1 is
+// left alone otherwise). The interrupt parses each
+// byte as it arrives and puts a message on the TXQ_THRU queue
+// once it is complete, so it goes out ahead of our own at the
+// next message boundary. It waits for the rest of the message
+// going out and at worst one byte already in TXREG. The
+// status byte is stored with every message (the input may be 
+// using running status) and the output applies its own running
+// status. Realtime bytes go out straight away, even in the
+// middle of another message. A SysEx is passed on as it comes
+// in and holds up everything else until it ends, or until the
+// input has gone quiet for MIDI_IN_TIMEOUT ms
+#define MIDI_IN_TIMEOUT 100
+volatile byte midiInStatus = 0;		// status of the message coming in, 0xf0 in a SysEx, 0 if none
+volatile byte midiInRealtime = 0;	// realtime byte waiting to go out, 0 if none
+#ifdef MIDI_IN
+byte midiInMsg[3];					// channel or system common message so far, status first
+byte midiInCount = 0;				// bytes of it
+volatile byte midiInTick = 0;		// sysTicks when the last byte came in
+#endif
+volatile unsigned int midiInDropped = 0;	// bytes lost to overrun, framing errors or a full queue
+
+// String scan timing. Each shift register output is given time
+// to settle before the inputs are sampled and the next output is
+// clocked on. Timer 2 counts at 2us. SCAN_SETTLE_US is used for
+// any column that has not been calibrated, and SCAN_SETTLE_MIN
+// (in timer counts) leaves time for the interrupt handler to run.
+// Its longest entry, counted in instruction cycles (0.5us at
+// 8MHz) from the source, as there is no listing to hand:
+//
+//   entry, context save and exit             14
+//   timer flags and frame pointer            25
+//   sample the stylus and three key rows     43
+//   clock on the next column                 10
+//   period, frame ticks and next step        22
+//   frame end (after column 15)              75
+//   system tick in the same entry             6
+//   MIDI byte out in the same entry          40
+//                                           ---
+//                                           235 = 118us
+//
+// so the period register is kept at 59 or more (120us) and the
+// handler is always done before timer 2 matches again. A column
+// without the frame end or a tick takes about 114 cycles (57us)
+#define SCAN_SETTLE_US 250
+#define SCAN_TICK_US 2
+#define SCAN_SETTLE_MIN 59
+#if SCAN_SETTLE_US < (SCAN_SETTLE_MIN+1)*SCAN_TICK_US || SCAN_SETTLE_US > 510
+#error SCAN_SETTLE_US out of range
+#endif
+#define SCAN_SETTLE_DEFAULT ((SCAN_SETTLE_US/SCAN_TICK_US)-1)
+
+// Per column settle times as timer 2 period register values. The
+// stylus and chord button lines are calibrated separately and a
+// column waits for whichever is slower
+byte stringSettle[16];
+byte keySettle[16];
+byte scanPeriod[16];	// the slower of the two for each column
+
+// The strings are scanned as fast as their settle times allow, 
+// but the chord buttons change far less often so they are only 
+// scanned in one frame every KEY_SCAN_TICKS system ticks (about
+// 200Hz). Only those frames wait for the chord button lines. If
+// they are no slower than the stylus every frame scans them
+#define KEY_SCAN_TICKS 5
+byte keyScanTicks = 0;			// KEY_SCAN_TICKS, or 0 for every frame
+byte keyScanTick = 0;			// sysTicks when the last one started
+volatile byte scanKeys = 1;		// the frame being filled scans the chord buttons
+
+// The inputs sampled over one pass of the shift register
+typedef struct 
+{
+	unsigned int stylus;	// strings touching the stylus, bit per column
+	unsigned int keys[3];	// chord buttons held in each row, bit per column
+	byte mode;				// MODE button held
+	byte keysScanned;		// keys were sampled in this frame (otherwise they are the last ones seen)
+	word stamp;		// timer 1 when the first column was sampled
+} SCAN_FRAME;
+
+// The timer interrupt fills one frame while pollIO works on the
+// other, so input settling time overlaps with event processing
+SCAN_FRAME scanFrames[2];
+volatile byte scanWrite = 0;		// frame being filled by the interrupt
+volatile byte scanFrameReady = 0;	// set when the other frame is complete
+byte scanStep = 0;					// column currently settling
+unsigned int scanBit = 1;			// ..as a bit mask
+unsigned int scanLastKeys[3];		// chord buttons from the last frame that scanned them
+
+// Scan rate statistics
+unsigned int scanOverruns = 0;		// frames dropped because pollIO was busy
+unsigned int scanCount = 0;			// frames completed so far this second
+unsigned int scansPerSecond = 0;	// frames completed in the last second
+unsigned int scanFrameTicks = 0;	// timer counts in the current frame
+unsigned long scanClock = 0;		// timer counts so far this second
+
+// System tick, counted by the timer 0 interrupt. Timer 0 runs
+// from Fosc/4 with a 1:8 prescaler and overflows every 1.024ms
+volatile byte sysTicks = 0;
+
+// Strum speed. Timer 1 runs free from Fosc/4 with a 1:8 prescaler
+// (4us) to time the stylus crossing from one string to the next.
+// Strums slower than STRUM_TIMEOUT_MS between strings start over
+#define STRUM_TIMEOUT_MS 200
+byte strumString = NO_SELECTION;	// last string to start a note
+word strumTime = 0;			// ..when, in timer 1 counts
+byte strumTick = 0;					// ..and in sysTicks
+byte strumLevel = 127;				// velocity of the last strummed note
+
+// Read timer 1 into an unsigned int. The low byte can carry into
+// the high byte between the two reads, in which case read again
+#define READ_TIMER1(v) { \
+	byte hi = HAL_TMR1H; \
+	byte lo = HAL_TMR1L; \
+	if(HAL_TMR1H != hi) { hi = HAL_TMR1H; lo = HAL_TMR1L; } \
+	(v) = ((word)hi<<8) | lo; }
+
+// Performance histograms, dumped as SysEx with MODE + row 1
+// column 4. Times are in timer 1 counts (4us). Bucket n counts
+// values of n bits, so bucket 0 is 0, 1 is 1, 2 is 2-3 and so
+// on, with the last bucket taking everything from 16384 up.
+// Counts stop at 127 so they fit in SysEx data bytes. They take
+// about 90 bytes of RAM with the latency timing, so they are only
+// kept when built with PERF_STATS defined. Otherwise the dump
+// has just the counts
+#define HIST_BUCKETS 16
+enum {
+	HIST_SCAN_PERIOD,	// first column of one frame to the next (drops show as doubles)
+	HIST_POLL_TIME,		// pollIO working on a frame
+	HIST_LATENCY,		// string contact sampled to first byte of its note into TXREG
+	HIST_CHORD_CHANGE,	// changeToChord
+	HIST_TX_DEPTH,		// bytes waiting in the TX buffer, once per frame
+	HIST_COUNT
+};
+#ifdef PERF_STATS
+byte histograms[HIST_COUNT * HIST_BUCKETS];
+word histLastStamp = 0;		// stamp of the last frame pollIO saw
+#define STATS_FIRST 0
+#else
+#define STATS_FIRST HIST_COUNT
+#endif
+
+// The dump is sent from the main loop a message at a time, each
+// when the queue it goes in has emptied, so it never holds up
+// the scan or anything else that is queued. Each message is 
+// queued whole so nothing can get into the middle of it, which
+// needs a queue of at least STATS_HIST_LEN bytes
+#define STATS_HIST_LEN 25		// bytes in a histogram message
+#define STATS_IDLE 0xff
+byte statsNext = STATS_IDLE;	// histogram to send next, HIST_COUNT for the counts
+#if TXQ_OTHER_SIZE <= STATS_HIST_LEN
+#error TXQ_OTHER_SIZE too small for a stats message
+#endif
+
+// MIDI panic is sent from the main loop too, a byte of a layer's
+// note set (up to 8 note offs) at a time once there is room for
+// it, so that the burst never has to wait for the queue.
+// panicStep has the layer in bit 5 (the drone) and in the low
+// bits the byte of notes to stop next, or 16 for the layer's
+// All Notes Off and All Sound Off
+#define PANIC_NOTES_LEN 24		// bytes in a byte of note offs
+#define PANIC_DRONE 0x20
+#define PANIC_IDLE 0xff
+byte panicStep = PANIC_IDLE;
+#if TXQ_OTHER_SIZE <= PANIC_NOTES_LEN
+#error TXQ_OTHER_SIZE too small for a byte of note offs
+#endif
+
+// Scan trace capture. Build with SCAN_TRACE defined to send every
+// scan frame whose inputs have changed as SysEx, so a performance
+// can be recorded (e.g. with amidi -r) and replayed through the
+// host build with strumreplay. A frame is also sent after
+// TRACE_IDLE_FRAMES without a change so the 16 bit timer 1 stamps
+// can be unwrapped. Each message is TRACE_SYSEX_LEN bytes (7ms
+// of MIDI), so in a fast strum there is not always room for it
+// in the TX buffer. Rather than hold up the scan, the frame is
+// skipped and what it saw is added into the next one sent
+#ifdef SCAN_TRACE
+#define TRACE_IDLE_FRAMES 32
+#define TRACE_SYSEX_LEN 22
+#if TXQ_OTHER_SIZE <= TRACE_SYSEX_LEN
+#error TXQ_OTHER_SIZE too small for a trace message
+#endif
+SCAN_FRAME traceLast;		// last frame sent
+SCAN_FRAME traceMissed;		// inputs seen in frames skipped since
+byte traceIdle = 0;
+#endif
+
+#ifdef PERF_STATS
+// Contact to TXREG latency is measured for one note at a time
+enum {
+	LATENCY_IDLE,
+	LATENCY_ARMED,		// waiting for the note to be queued
+	LATENCY_QUEUED,		// waiting for the ISR to start the message at latencyPos
+	LATENCY_SENT		// ..which it did at latencyEnd
+};
+volatile byte latencyState = LATENCY_IDLE;
+byte latencyQueue = 0;
+byte latencyPos = 0;
+word latencyStart = 0;
+volatile word latencyEnd = 0;
+#endif
+
+// Strum speed to velocity curves (linear, soft, hard). Each has
+// 16 velocities for string to string times from under 0.5ms
+// (fastest) to over 65ms in half octave steps
+rom char *velocityCurves = 
+	"\x7f\x78\x70\x68\x60\x58\x50\x48\x40\x38\x30\x28\x20\x1c\x18\x14"
+	"\x7f\x7c\x78\x74\x6f\x6a\x64\x5e\x58\x51\x4a\x42\x3a\x32\x2a\x22"
+	"\x7f\x70\x62\x56\x4b\x41\x38\x30\x29\x23\x1e\x1a\x16\x13\x10\x0e";
+
+// LED blink codes. Feedback to the player is queued here and
+// played out from pollIO a step at a time, so nothing has to
+// wait for the LED. Times are in LED_TICK_MS units
+#define LED_TICK_MS 10
+#define LED_QUEUE_SIZE 4	// must be a power of 2
+#define LED_QUEUE_MASK (LED_QUEUE_SIZE-1)
+typedef struct 
+{
+	byte on;		// time lit
+	byte off;		// time dark after each flash
+	byte count;		// number of flashes
+} LED_BLINK;
+LED_BLINK ledQueue[LED_QUEUE_SIZE];
+byte ledQueueHead = 0;
+byte ledQueueTail = 0;
+LED_BLINK ledBlink;				// blink code being played
+byte ledTimer = 0;				// time left in the current step
+byte ledLit = 0;				// LED is lit for a blink code
+byte ledTick = 0;				// sysTicks at the last step
+volatile byte ledBusy = 0;		// blink codes own the LED
+
+// Scheduled events. MIDI messages (and arpeggiator steps) can
+// be posted to go out a number of system ticks from now. They
+// are kept in a timer wheel of EVENT_SLOTS lists, each holding
+// the events whose tick falls in it modulo EVENT_SLOTS, so a 
+// tick only has to look at its own list. An event further 
+// ahead than that is passed over until its tick comes round
+#define EVENT_POOL 8
+#define EVENT_SLOTS 8		// must be a power of 2
+#define EVENT_SLOT_MASK (EVENT_SLOTS-1)
+#define EVENT_NONE 0xff
+#define EVENT_ARP 0x00		// arpeggiator step, in place of a MIDI status
+typedef struct 
+{
+	byte next;		// next event in the same list, EVENT_NONE if none
+	byte when;		// sysTicks when it is due
+	byte status;	// MIDI status, or EVENT_ARP
+	byte data1;
+	byte data2;
+} EVENT;
+EVENT events[EVENT_POOL];
+byte eventWheel[EVENT_SLOTS];	// first event in each slot
+byte eventFree = EVENT_NONE;	// first unused event
+byte eventTick = 0;				// last tick that has been run
+byte eventOverflows = 0;		// events not posted for lack of room
+
+// Arpeggiator. While a chord is held it plays the notes on the
+// strings in turn, lowest string first, a step at a time. Each
+// note is stopped half way through its step. The rate is set 
+// with MODE + row 1 column 7 and then a string, from the 
+// slowest on string 2 to the fastest on string 16 (string 1 
+// turns it off). Steps are in sysTicks
+rom char *arpSteps = "\xf0\xc8\xaa\x96\x82\x73\x64\x5a\x50\x46\x3c\x32\x2d\x28\x23";
+byte arpString = 15;			// string of the last note played
+byte arpRunning = 0;			// a step has been posted
+
 ////////////////////////////////////////////////////////////
 //
 //
@@ -261,145 +656,370 @@ const unsigned int patch_OrganButtonsChromatic =
 const unsigned int DefaultSettings = 0;
 
 unsigned int options = patch_BasicStrum;
+unsigned int userOptions = patch_BasicStrum;	// the saved user patch
 unsigned int settings = DefaultSettings;
 byte playChannel = DEFAULT_PLAY_CHANNEL;
 byte droneChannel = DEFAULT_DRONE_CHANNEL;
 byte droneOctave = DEFAULT_DRONE_OCTAVE;
 
+// Settings journal record layout
+enum {
+	JOURNAL_SEQ,
+	JOURNAL_OPTIONS_HIGH,
+	JOURNAL_OPTIONS_LOW,
+	JOURNAL_SETTINGS_HIGH,
+	JOURNAL_SETTINGS_LOW,
+	JOURNAL_CHANNELS,		// play channel << 4 | drone channel
+	JOURNAL_DRONE_OCTAVE,
+	JOURNAL_CHECK,
+	JOURNAL_RECORD_SIZE
+};
+#define JOURNAL_SLOTS 8			// fills EEPROM from EEPROM_ADDR_JOURNAL to the end
+#define JOURNAL_CHECKSUM 0x5a	// all the bytes of a record add up to this
+
+byte journalSeq = 0;			// sequence number of the newest record
+byte journalSlot = 0;			// ..and where it is
+byte journalDirty = 0;			// settings have changed since it was written
+
+// Preset record layout
+enum {
+	PRESET_FORMAT,			// PRESET_FORMAT_VERSION
+	PRESET_OPTIONS_HIGH,
+	PRESET_OPTIONS_LOW,
+	PRESET_SETTINGS_HIGH,
+	PRESET_SETTINGS_LOW,
+	PRESET_CHANNELS,		// play channel << 4 | drone channel
+	PRESET_DRONE_OCTAVE,
+	PRESET_DRONE_KEYS_HIGH,
+	PRESET_DRONE_KEYS_LOW,
+	PRESET_VELOCITY,
+	PRESET_CRC,				// CRC-8 of the bytes before it
+	PRESET_RECORD_SIZE
+};
+#define PRESET_SLOTS 8			// picked with strings 1 to 8
+#define PRESET_FORMAT_VERSION 1
+
+byte presetStore = NO_SELECTION;	// preset slot waiting to be written
+
+// EEPROM record writer, shared by the journal and the presets
+byte eepromRecord[PRESET_RECORD_SIZE];	// record being written
+byte eepromRecordAddr = 0;				// ..where it goes
+byte eepromRecordLen = 0;				// ..its length
+byte eepromRecordPos = 0;				// next byte of it to write
+
 ////////////////////////////////////////////////////////////
 //
-// TOGGLE A USER OPTION
+// QUEUE A BLINK CODE
+// The code is dropped if the queue is full
 //
 ////////////////////////////////////////////////////////////
-void toggleOption(unsigned long o)
+void ledQueueBlink(byte on, byte off, byte count)
 {
-	if(options & o)
-	{
-		options &= ~o;
-		P_LED = 1;
-		delay_ms(10);
-		P_LED = 0;
-	}
-	else
-	{
-		options |= o;
-		P_LED = 1;
-		delay_ms(10);
-		P_LED = 0;
-		delay_ms(100);
-		P_LED = 1;
-		delay_ms(10);
-		P_LED = 0;
-	}
+	byte next = (ledQueueHead + 1) & LED_QUEUE_MASK;
+	if(next == ledQueueTail)
+		return;
+	ledQueue[ledQueueHead].on = on;
+	ledQueue[ledQueueHead].off = off;
+	ledQueue[ledQueueHead].count = count;
+	ledQueueHead = next;
+	ledBusy = 1;
 }
 
 ////////////////////////////////////////////////////////////
 //
-// CLEAR USER OPTION
+// DROP ANY QUEUED BLINK CODES AND GIVE BACK THE LED
 //
 ////////////////////////////////////////////////////////////
-void clearOptions(unsigned long o)
+void ledCancel()
 {
-	options &= ~o;
+	ledQueueTail = ledQueueHead;
+	ledBlink.count = 0;
+	ledTimer = 0;
+	ledLit = 0;
+	ledBusy = 0;
+	HAL_LED(0);
+}
+
+////////////////////////////////////////////////////////////
+//
+// SET THE LED UNLESS A BLINK CODE IS SHOWING
+//
+////////////////////////////////////////////////////////////
+void ledIdle(byte on)
+{
+	if(!ledBusy)
+		HAL_LED(on);
 }
 
 ////////////////////////////////////////////////////////////
 //
-// load the EEEPROM info
+// PLAY OUT THE BLINK CODES
+// Called on every pass of the main loop
 //
 ////////////////////////////////////////////////////////////
-void loadSettingsFromEEPROM()
+void serviceLed()
 {
-	if(eeprom_read(EEPROM_ADDR_MAGIC_COOKIE) != EEPROM_MAGIC_COOKIE)
+	byte now = sysTicks;
+	if((byte)(now - ledTick) < LED_TICK_MS)
+		return;
+	ledTick = now;
+
+	// still in the middle of a step?
+	if(ledTimer && --ledTimer)
+		return;
+
+	// end of a flash, go dark for a while. Flashes with no
+	// dark time run together, with a short gap after the last
+	if(ledLit && (ledBlink.off || !ledBlink.count))
 	{
-		options = patch_BasicStrum;
-		settings = DefaultSettings;
-		eeprom_write(EEPROM_ADDR_OPTIONS_HIGH, (options >> 8) & 0xff);
-		eeprom_write(EEPROM_ADDR_OPTIONS_LOW, options & 0xff);
-		eeprom_write(EEPROM_ADDR_SETTINGS_HIGH, (settings >> 8) & 0xff);
-		eeprom_write(EEPROM_ADDR_SETTINGS_LOW, settings & 0xff);
-		eeprom_write(EEPROM_ADDR_PLAY_CHANNEL, DEFAULT_PLAY_CHANNEL);
-		eeprom_write(EEPROM_ADDR_DRONE_CHANNEL, DEFAULT_DRONE_CHANNEL);
-		eeprom_write(EEPROM_ADDR_DRONE_OCTAVE, DEFAULT_DRONE_OCTAVE);		
-		eeprom_write(EEPROM_ADDR_MAGIC_COOKIE, EEPROM_MAGIC_COOKIE);
-		P_LED = 1;	delay_s(4);	P_LED = 0; 		
+		HAL_LED(0);
+		ledLit = 0;
+		ledTimer = ledBlink.off? ledBlink.off : 1;
+		return;
+	}
+
+	// next flash of this code, or the next code
+	if(!ledBlink.count)
+	{
+		if(ledQueueHead == ledQueueTail)
+		{
+			ledBusy = 0;
+			return;
+		}
+		ledBlink = ledQueue[ledQueueTail];
+		ledQueueTail = (ledQueueTail + 1) & LED_QUEUE_MASK;
+	}
+	--ledBlink.count;
+	HAL_LED(1);
+	ledLit = 1;
+	ledTimer = ledBlink.on;
+}
+
+////////////////////////////////////////////////////////////
+//
+// TOGGLE A USER OPTION
+//
+////////////////////////////////////////////////////////////
+void toggleOption(unsigned long o)
+{
+	if(options & o)
+	{
+		options &= ~o;
+		ledQueueBlink(1, 10, 1);	// one short flash for off
 	}
 	else
 	{
-		options = 
-				(unsigned int)eeprom_read(EEPROM_ADDR_OPTIONS_HIGH)<<8 | 		
-				(unsigned int)eeprom_read(EEPROM_ADDR_OPTIONS_LOW);
-		settings = 
-				(unsigned int)eeprom_read(EEPROM_ADDR_SETTINGS_HIGH)<<8 | 						
-				(unsigned int)eeprom_read(EEPROM_ADDR_SETTINGS_LOW);
-		playChannel = eeprom_read(EEPROM_ADDR_PLAY_CHANNEL);
-		droneChannel = eeprom_read(EEPROM_ADDR_DRONE_CHANNEL);
-		droneOctave = eeprom_read(EEPROM_ADDR_DRONE_OCTAVE);
+		options |= o;
+		ledQueueBlink(1, 10, 2);	// two for on
 	}
 }
 
 ////////////////////////////////////////////////////////////
 //
-// LOAD USER OPTIONS FROM EEPROM
+// CLEAR USER OPTION
 //
 ////////////////////////////////////////////////////////////
-void loadUserPatch()
+void clearOptions(unsigned long o)
 {
-	options = 
-			(unsigned int)eeprom_read(EEPROM_ADDR_OPTIONS_HIGH)<<8 | 		
-			(unsigned int)eeprom_read(EEPROM_ADDR_OPTIONS_LOW);
-	P_LED = 1; delay_ms(10); P_LED = 0; delay_ms(100);
-	P_LED = 1; delay_ms(10); P_LED = 0; delay_ms(100);
-	P_LED = 1; delay_ms(10); P_LED = 0; delay_ms(100);
+	options &= ~o;
 }
 
+#ifndef STRUM_HOST
 ////////////////////////////////////////////////////////////
 //
-// SAVE USER OPTIONS TO EEPROM
+// START AN EEPROM WRITE WITHOUT WAITING FOR IT TO FINISH
+// Check HAL_EEPROM_BUSY before starting the next one
+// (the host build gets this from the simulator)
 //
 ////////////////////////////////////////////////////////////
-void saveUserPatch()
+void eeprom_write_start(byte address, byte data)
+{
+	eeadrl = address;
+	eedatl = data;
+	eecon1.7 = 0;	// EEPGD, data memory
+	eecon1.6 = 0;	// CFGS
+	eecon1.2 = 1;	// WREN
+	intcon.7 = 0;	// no interrupts during the unlock sequence
+	eecon2 = 0x55;
+	eecon2 = 0xaa;
+	eecon1.1 = 1;	// WR
+	intcon.7 = 1;
+	eecon1.2 = 0;
+}
+#endif // STRUM_HOST
+
+// Read a byte of EEPROM, first waiting for any write started by
+// serviceEeprom to finish, as the EEPROM cannot be read during
+// a write cycle
+byte eepromRead(byte address)
 {
-	eeprom_write(EEPROM_ADDR_OPTIONS_HIGH, (options >> 8) & 0xff);
-	eeprom_write(EEPROM_ADDR_OPTIONS_LOW, options & 0xff);
-	P_LED = 1;	delay_s(2);	P_LED = 0;
+	while(HAL_EEPROM_BUSY)
+		HAL_IDLE();
+	return eeprom_read(address);
 }
 
 ////////////////////////////////////////////////////////////
 //
-// TOGGLE SETTINGS AND SAVE
+// SETTINGS JOURNAL
+//
+// The user patch and device settings are saved together as
+// one record. Each save goes into the next slot of a ring of
+// records at the top of the EEPROM, so no cell takes more
+// than its share of the wear. The write goes out a byte at a
+// time from the main loop, and settings that change in the
+// meantime are picked up by the next record.
+//
+// At power on the valid record with the newest sequence 
+// number is loaded. A record that was only partly written
+// when the power went fails its checksum, so the one before
+// it is used instead. Settings saved by the original firmware
+// go into the ring with the first write
 //
 ////////////////////////////////////////////////////////////
-void toggleSetting(unsigned int o)
+void journalLoad()
 {
-	settings ^= o;
-	eeprom_write(EEPROM_ADDR_SETTINGS_HIGH, (settings >> 8) & 0xff);
-	eeprom_write(EEPROM_ADDR_SETTINGS_LOW, settings & 0xff);
-	P_LED = 1;	delay_s(2);	P_LED = 0;
+	byte slot, i;
+	byte record[JOURNAL_RECORD_SIZE];
+	byte found = 0;
+	byte addr = EEPROM_ADDR_JOURNAL;
+	for(slot = 0; slot < JOURNAL_SLOTS; ++slot)
+	{
+		byte sum = 0;
+		for(i=0; i<JOURNAL_RECORD_SIZE; ++i)
+		{
+			record[i] = eepromRead(addr + i);
+			sum += record[i];
+		}
+		addr += JOURNAL_RECORD_SIZE;
+		if(sum != JOURNAL_CHECKSUM)
+			continue;
+			
+		// newer than the best so far? (sequence number wraps)
+		if(found && (signed char)(record[JOURNAL_SEQ] - journalSeq) <= 0)
+			continue;
+		found = 1;
+		journalSeq = record[JOURNAL_SEQ];
+		journalSlot = slot;
+		userOptions = (unsigned int)record[JOURNAL_OPTIONS_HIGH]<<8 | record[JOURNAL_OPTIONS_LOW];
+		settings = (unsigned int)record[JOURNAL_SETTINGS_HIGH]<<8 | record[JOURNAL_SETTINGS_LOW];
+		playChannel = record[JOURNAL_CHANNELS] >> 4;
+		droneChannel = record[JOURNAL_CHANNELS] & 0x0f;
+		droneOctave = record[JOURNAL_DRONE_OCTAVE];
+	}
+	if(found)
+		return;
+	if(eepromRead(EEPROM_ADDR_MAGIC_COOKIE) == EEPROM_MAGIC_COOKIE)
+	{
+		// settings saved by older firmware
+		userOptions = 
+				(unsigned int)eepromRead(EEPROM_ADDR_OPTIONS_HIGH)<<8 | 		
+				(unsigned int)eepromRead(EEPROM_ADDR_OPTIONS_LOW);
+		settings = 
+				(unsigned int)eepromRead(EEPROM_ADDR_SETTINGS_HIGH)<<8 | 						
+				(unsigned int)eepromRead(EEPROM_ADDR_SETTINGS_LOW);
+		playChannel = eepromRead(EEPROM_ADDR_PLAY_CHANNEL) & 0x0f;
+		droneChannel = eepromRead(EEPROM_ADDR_DRONE_CHANNEL) & 0x0f;
+		droneOctave = eepromRead(EEPROM_ADDR_DRONE_OCTAVE);
+	}
+	else
+	{
+		// nothing stored at all
+		userOptions = patch_BasicStrum;
+		settings = DefaultSettings;
+		playChannel = DEFAULT_PLAY_CHANNEL;
+		droneChannel = DEFAULT_DRONE_CHANNEL;
+		droneOctave = DEFAULT_DRONE_OCTAVE;
+		ledQueueBlink(200, 0, 2);	// 4 seconds
+	}
+	
+	// start the journal off with what we have
+	journalSlot = JOURNAL_SLOTS - 1;
+	journalDirty = 1;
+}
+
+// CRC-8, polynomial x^8+x^2+x+1
+byte crc8(byte *data, byte len)
+{
+	byte crc = 0, i;
+	while(len--)
+	{
+		crc ^= *data++;
+		for(i=0; i<8; ++i)
+			crc = (crc & 0x80)? (crc << 1) ^ 0x07 : crc << 1;
+	}
+	return crc;
 }
 
 ////////////////////////////////////////////////////////////
 //
-// SET PLAY CHANNEL
+// WRITE THE NEXT BYTE OF A PRESET OR JOURNAL RECORD
+// Called on every pass of the main loop. A preset waiting to
+// be stored goes before the journal
 //
 ////////////////////////////////////////////////////////////
-void setPlayChannel(byte c)
+void serviceEeprom()
 {
-	playChannel = c&0xF;
-	eeprom_write(EEPROM_ADDR_PLAY_CHANNEL, playChannel);
-	P_LED = 1;	delay_s(2);	P_LED = 0;
+	if(eepromRecordPos >= eepromRecordLen)
+	{
+		byte i;
+		if(presetStore != NO_SELECTION)
+		{
+			// snapshot the patch and settings into the preset
+			eepromRecord[PRESET_FORMAT] = PRESET_FORMAT_VERSION;
+			eepromRecord[PRESET_OPTIONS_HIGH] = options >> 8;
+			eepromRecord[PRESET_OPTIONS_LOW] = options & 0xff;
+			eepromRecord[PRESET_SETTINGS_HIGH] = settings >> 8;
+			eepromRecord[PRESET_SETTINGS_LOW] = settings & 0xff;
+			eepromRecord[PRESET_CHANNELS] = (playChannel << 4) | droneChannel;
+			eepromRecord[PRESET_DRONE_OCTAVE] = droneOctave;
+			eepromRecord[PRESET_DRONE_KEYS_HIGH] = droneKeys >> 8;
+			eepromRecord[PRESET_DRONE_KEYS_LOW] = droneKeys & 0xff;
+			eepromRecord[PRESET_VELOCITY] = playVelocity;
+			eepromRecord[PRESET_CRC] = crc8(eepromRecord, PRESET_CRC);
+			eepromRecordAddr = EEPROM_ADDR_PRESETS + presetStore * PRESET_RECORD_SIZE;
+			eepromRecordLen = PRESET_RECORD_SIZE;
+			presetStore = NO_SELECTION;
+		}
+		else if(journalDirty)
+		{
+			// snapshot the settings into a new journal record
+			journalDirty = 0;
+			eepromRecord[JOURNAL_SEQ] = ++journalSeq;
+			eepromRecord[JOURNAL_OPTIONS_HIGH] = userOptions >> 8;
+			eepromRecord[JOURNAL_OPTIONS_LOW] = userOptions & 0xff;
+			eepromRecord[JOURNAL_SETTINGS_HIGH] = settings >> 8;
+			eepromRecord[JOURNAL_SETTINGS_LOW] = settings & 0xff;
+			eepromRecord[JOURNAL_CHANNELS] = (playChannel << 4) | droneChannel;
+			eepromRecord[JOURNAL_DRONE_OCTAVE] = droneOctave;
+			byte sum = 0;
+			for(i=0; i<JOURNAL_RECORD_SIZE-1; ++i)
+				sum += eepromRecord[i];
+			eepromRecord[JOURNAL_CHECK] = JOURNAL_CHECKSUM - sum;
+			if(++journalSlot >= JOURNAL_SLOTS)
+				journalSlot = 0;
+			eepromRecordAddr = EEPROM_ADDR_JOURNAL + journalSlot * JOURNAL_RECORD_SIZE;
+			eepromRecordLen = JOURNAL_RECORD_SIZE;
+		}
+		else
+			return;
+		eepromRecordPos = 0;
+	}
+	if(HAL_EEPROM_BUSY)
+		return;
+	eeprom_write_start(eepromRecordAddr + eepromRecordPos, eepromRecord[eepromRecordPos]);
+	++eepromRecordPos;
 }
 
 ////////////////////////////////////////////////////////////
 //
-// SET DRONE CHANNEL
+// TOGGLE SETTINGS AND SAVE
 //
 ////////////////////////////////////////////////////////////
-void setDroneChannel(byte c)
+void toggleSetting(unsigned int o)
 {
-	droneChannel = c&0xF;
-	eeprom_write(EEPROM_ADDR_DRONE_CHANNEL, droneChannel);
-	P_LED = 1;	delay_s(2);	P_LED = 0;
+	settings ^= o;
+	journalDirty = 1;
+	ledQueueBlink(200, 0, 1);	// 2 seconds
 }
 
 ////////////////////////////////////////////////////////////
@@ -414,8 +1034,8 @@ void setDroneOctave(byte c)
 	}
 	if(c!=droneOctave) {
 		droneOctave	= c;
-		eeprom_write(EEPROM_ADDR_DRONE_OCTAVE, droneOctave);
-		P_LED = 1;	delay_s(1);	P_LED = 0;
+		journalDirty = 1;
+		ledQueueBlink(100, 0, 1);	// 1 second
 	}
 }
 
@@ -427,20 +1047,50 @@ void setDroneOctave(byte c)
 void presetPatch(unsigned int o)
 {
 	options = o;
-	P_LED = 1; delay_ms(10); P_LED = 0; delay_ms(100);
-	P_LED = 1; delay_ms(10); P_LED = 0; delay_ms(100);
-	P_LED = 1; delay_ms(10); P_LED = 0; delay_ms(100);
+	ledQueueBlink(1, 10, 3);
+}
+
+#ifndef STRUM_HOST
+////////////////////////////////////////////////////////////
+//
+// INITIALISE IO PORTS
+// (the host build gets this from the simulator)
+//
+////////////////////////////////////////////////////////////
+void init_ports()
+{
+	// osc control / 8MHz / internal
+	osccon = 0b01110010;
+
+	// weak pull up on A0 and C5, and on the MIDI in pin RA1 so
+	// that it idles high if nothing is plugged in
+#ifdef MIDI_IN
+	wpua = 0b00000011;
+#else
+	wpua = 0b00000001;
+#endif
+	wpuc = 0b00100000;
+	option_reg.7 = 0;
+	
+	
+	// configure io
+			//76543210
+	trisa = 0b00110010;              	
+    trisc = 0b00101010;              
+    
+	ansela = 0b00000000;
+	anselc = 0b00000000;
 }
 
 ////////////////////////////////////////////////////////////
 //
 // INITIALISE SERIAL PORT FOR MIDI
+// (the host build gets this from the simulator)
 //
 ////////////////////////////////////////////////////////////
 void init_usart()
 {
-	pir1.1 = 1;	//TXIF transmit enable
-	pie1.1 = 0;	//TXIE no interrupts
+	pie1.4 = 0;	//TXIE enabled by send() when there is data
 	
 	baudcon.4 = 0;		// synchronous bit polarity 
 	baudcon.3 = 1;		// enable 16 bit brg
@@ -454,323 +1104,1300 @@ void init_usart()
 
 	rcsta.7 = 1;	// serial port enable
 	rcsta.6 = 0;	// 8 bit operation
-	rcsta.4 = 0;	// enable receiver
+#ifdef MIDI_IN
+	rcsta.4 = 1;	// enable receiver
+
+	// RX moves to RA1, since RC5 is the MODE button
+	apfcon0.7 = 1;
+	pie1.5 = 1;		// RCIE
+#endif
 		
 	spbrgh = 0;		// brg high byte
 	spbrg = 15;		// brg low byte (31250)	
+
+	intcon.6 = 1;	// peripheral interrupts enable
+	intcon.7 = 1;	// global interrupts enable
 }
 
 ////////////////////////////////////////////////////////////
 //
-// SEND A MIDI BYTE
+// INITIALISE TIMER 2 FOR THE STRING SCAN INTERRUPT
+// (the host build gets this from the simulator)
 //
 ////////////////////////////////////////////////////////////
-void send(unsigned char c)
+void init_timer2(byte period)
 {
-	txreg = c;
-	while(!txsta.1);
+	pr2 = period;
+	tmr2 = 0;
+	t2con = 0b00000101;	// postscale 1:1, timer on, prescale 1:4 (2us)
+	pir1.1 = 0;			// clear TMR2IF
+	pie1.1 = 1;			// TMR2IE
 }
 
 ////////////////////////////////////////////////////////////
 //
-// START NOTE MESSAGE
+// INITIALISE TIMER 0 FOR THE SYSTEM TICK
 //
 ////////////////////////////////////////////////////////////
-void startNote(byte channel, byte note, byte value)
+void init_timer0()
 {
-	P_LED = 1;
-	send(0x90 | channel);
-	send(note&0x7f);
-	send(value&0x7f);
-	P_LED = 0;	
+	option_reg = 0b01000010;	// pull ups on, Fosc/4, prescaler 1:8 (4us)
+	tmr0 = 0;
+	intcon.2 = 0;		// clear TMR0IF
+	intcon.5 = 1;		// TMR0IE
 }
 
 ////////////////////////////////////////////////////////////
 //
-// STOP NOTE MESSAGE
+// INITIALISE TIMER 1 TO RUN FREE FOR TIMESTAMPS
 //
 ////////////////////////////////////////////////////////////
-void stopNote(byte channel, byte note)
+void init_timer1()
 {
-	P_LED = 1;
-	send(0x90 | channel);
-	send(note&0x7f);
-	send(0x00);
-	P_LED = 0;	
+	t1con = 0b00110001;	// Fosc/4, prescale 1:8 (4us), timer on
+	tmr1h = 0;
+	tmr1l = 0;
 }
 
 ////////////////////////////////////////////////////////////
 //
-// STOP ALL NOTES
+// INITIALISE THE MSSP TO CLOCK THE SHIFT REGISTER
 //
 ////////////////////////////////////////////////////////////
-void stopAllNotes(byte channel)
+#ifdef SCAN_SPI
+void init_spi()
 {
-	for(int i=0;i<128;++i)
-		stopNote(channel,i);
+	ssp1stat = 0b01000000;	// data changes on the falling edge of SCK (CKE)
+	ssp1con1 = 0b00100000;	// SPI master, Fosc/4 (0.5us per bit), SCK idles low
+	pir1.3 = 0;				// clear SSP1IF
 }
+#endif
+#endif // STRUM_HOST
 
 ////////////////////////////////////////////////////////////
 //
-// GUITAR CHORD SHAPE DEFINITIONS
+// COLUMN SELECT SHIFT REGISTER
+// The walking bit is clocked in from port pins a bit at a time
+// or, with SCAN_SPI, the MSSP shifts out a whole 16 bit pattern 
+// for each column. Since the shift and store clock lines are 
+// tied together the outputs show the register from before the
+// last clock pulse
 //
 ////////////////////////////////////////////////////////////
-void guitarCShape(byte ofs, byte extension, byte *chord)
+#ifdef SCAN_SPI
+
+// Pattern for each column, sent high byte first. Each is one
+// place further on than its column because of the lag, and the
+// one for column 14 leaves a bit at the end which appears on
+// column 15 when the empty pattern for column 15 goes in after it
+rom char *scanPatternHigh = 
+	"\x00\x00\x00\x00\x00\x00\x00\x01\x02\x04\x08\x10\x20\x40\x80\x00";
+rom char *scanPatternLow = 
+	"\x02\x04\x08\x10\x20\x40\x80\x00\x00\x00\x00\x00\x00\x00\x01\x00";
+
+void spiSend(byte c)
 {
-	if(options & OPT_GUITARBASSNOTES)
-		chord[0] = 43 + ofs;
-	chord[1] = 48 + ofs;
-	chord[2] = 52 + ofs + (extension == SUS_4);
-	chord[3] = 55 + ofs + 2 * (extension == ADD_6);
-	chord[4] = 60 + ofs + 2 * (extension == ADD_9);
-	chord[5] = 64 + ofs + (extension == SUS_4);
+	HAL_SSPIF_CLEAR();
+	HAL_SSPBUF(c);
+	while(!HAL_SSPIF)
+		HAL_IDLE();
 }
-void guitarC7Shape(byte ofs, byte extension, byte *chord)
+
+// Move the walking bit on from the column before col to col, or
+// off the outputs if col is past the last column
+void stepColumn(byte col)
 {
-	if(options & OPT_GUITARBASSNOTES)
-		chord[0] = 43 + ofs;
-	chord[1] = 48 + ofs;
-	chord[2] = 52 + ofs + (extension == SUS_4);
-	chord[3] = 58 + ofs - (extension == ADD_6);
-	chord[4] = 60 + ofs + 2 * (extension == ADD_9);
-	chord[5] = 64 + ofs + (extension == SUS_4);
+	if(col < 16)
+	{
+		spiSend(scanPatternHigh[col]);
+		spiSend(scanPatternLow[col]);
+	}
+	else
+	{
+		spiSend(0);
+		spiSend(0);
+	}
 }
-void guitarAShape(byte ofs, byte extension, byte *chord)
+
+// Put the walking bit on a column, or take it off all of the 
+// outputs if col is NO_SELECTION, ready to step onto column 0.
+// Whatever was in the register is flushed out first, leaving the
+// bit behind for column 15 if that is the one wanted
+void selectColumn(byte col)
 {
-	if(options & OPT_GUITARBASSNOTES)
-		chord[0] = 40 + ofs;
-	chord[1] = 45 + ofs;
-	chord[2] = 52 + ofs + 2 * (extension == ADD_6);
-	chord[3] = 57 + ofs + 2 * (extension == ADD_9);;
-	chord[4] = 61 + ofs + (extension == SUS_4);
-	chord[5] = 64 + ofs;
+	stepColumn((col == 15)? 14 : NO_SELECTION);
+	stepColumn(col);
 }
-void guitarAmShape(byte ofs, byte extension, byte *chord)
+
+#else
+
+void stepColumn(byte col)
 {
-	if(options & OPT_GUITARBASSNOTES)
-		chord[0] = 40 + ofs;
-	chord[1] = 45 + ofs;
-	chord[2] = 52 + ofs + 2 * (extension == ADD_6);
-	chord[3] = 57 + ofs + 2 * (extension == ADD_9);;
-	chord[4] = 60 + ofs  + 2 * (extension == SUS_4);
-	chord[5] = 64 + ofs;
+	HAL_CLK(0);
+	HAL_CLK(1);
 }
-void guitarA7Shape(byte ofs, byte extension, byte *chord)
+
+// Put the walking bit on a column, or take it off all of the 
+// outputs if col is NO_SELECTION, ready to clock onto column 0
+void selectColumn(byte col)
 {
-	if(options & OPT_GUITARBASSNOTES)
-		chord[0] = 40 + ofs;
-	chord[1] = 45 + ofs;
-	chord[2] = 52 + ofs + 2 * (extension == ADD_6);
-	chord[3] = 55 + ofs + 4 * (extension == ADD_9);;
-	chord[4] = 61 + ofs + (extension == SUS_4);
-	chord[5] = 64 + ofs;
+	byte i;
+	HAL_DS(0);
+	for(i=0;i<16;++i)
+	{
+		HAL_CLK(0);
+		HAL_CLK(1);
+	}
+	HAL_DS(1);	
+	HAL_CLK(0);
+	HAL_CLK(1);
+	HAL_DS(0);	
+	if(col != NO_SELECTION)
+	{
+		for(i=0;i<=col;++i)
+		{
+			HAL_CLK(0);
+			HAL_CLK(1);
+		}
+	}
 }
-void guitarDShape(byte ofs, byte extension, byte *chord)
+
+#endif // SCAN_SPI
+
+////////////////////////////////////////////////////////////
+//
+// START THE STRING SCAN
+//
+////////////////////////////////////////////////////////////
+void initScan()
 {
-	if(options & OPT_GUITARBASSNOTES)
-		chord[1] = 45 + ofs;
-	chord[2] = 50 + ofs;
-	chord[3] = 57 + ofs + 2 * (extension == ADD_6);
-	chord[4] = 62 + ofs;
-	chord[5] = 66 + ofs  + (extension == SUS_4) - 2*(extension == ADD_9);
+	int i;
+
+	// first column is now settling
+	selectColumn(0);
+	scanStep = 0;
+	scanBit = 1;
+	memset(scanFrames, 0, sizeof(scanFrames));
+	scanWrite = 0;
+	scanFrameReady = 0;
+	scanFrameTicks = 0;
+	keyScanTicks = 0;
+	for(i=0;i<16;++i)
+	{
+		scanPeriod[i] = stringSettle[i];
+		if(keySettle[i] > scanPeriod[i])
+		{
+			scanPeriod[i] = keySettle[i];
+			keyScanTicks = KEY_SCAN_TICKS;
+		}
+	}
+
+	// first frame scans everything
+	scanKeys = 1;
+	scanFrames[0].keysScanned = 1;
+	keyScanTick = sysTicks;
+	init_timer2(scanPeriod[0]);
 }
-void guitarDmShape(byte ofs, byte extension, byte *chord)
+
+////////////////////////////////////////////////////////////
+//
+// LOAD SETTLE TIMES FROM EEPROM, OR DEFAULTS IF THE UNIT
+// HAS NOT BEEN CALIBRATED
+//
+////////////////////////////////////////////////////////////
+void loadSettleTimes()
 {
-	if(options & OPT_GUITARBASSNOTES)
-		chord[1] = 45 + ofs;
-	chord[2] = 50 + ofs;
-	chord[3] = 57 + ofs + 2 * (extension == ADD_6);
-	chord[4] = 62 + ofs;
-	chord[5] = 65 + ofs  + 2 * (extension == SUS_4) - (extension == ADD_9);
+	byte i;
+	byte calibrated = (eepromRead(EEPROM_ADDR_SETTLE_COOKIE) == EEPROM_SETTLE_COOKIE);
+	for(i=0;i<16;++i)
+	{
+		stringSettle[i] = calibrated? eepromRead(EEPROM_ADDR_STRING_SETTLE + i) : SCAN_SETTLE_DEFAULT;
+		keySettle[i] = calibrated? eepromRead(EEPROM_ADDR_KEY_SETTLE + i) : SCAN_SETTLE_DEFAULT;
+		if(stringSettle[i] < SCAN_SETTLE_MIN)
+			stringSettle[i] = SCAN_SETTLE_MIN;
+		if(keySettle[i] < SCAN_SETTLE_MIN)
+			keySettle[i] = SCAN_SETTLE_MIN;
+	}
 }
-void guitarD7Shape(byte ofs, byte extension, byte *chord)
+
+////////////////////////////////////////////////////////////
+//
+// SETTLE TIME CALIBRATION HELPERS
+//
+////////////////////////////////////////////////////////////
+
+// input lines as bits
+#define INPUT_STYLUS	0x01
+#define INPUT_KEYS		0x0e
+#define INPUT_KEYS1		0x02
+#define INPUT_KEYS2		0x04
+#define INPUT_KEYS3		0x08
+
+byte readInputs()
 {
-	if(options & OPT_GUITARBASSNOTES)
-		chord[1] = 45 + ofs;
-	chord[2] = 50 + ofs;
-	chord[3] = 57 + ofs + 2 * (extension == ADD_6);
-	chord[4] = 60 + ofs;
-	chord[5] = 66 + ofs  + (extension == SUS_4)- 2*(extension == ADD_9);
+	byte inputs = 0;
+	if(HAL_STYLUS)
+		inputs |= INPUT_STYLUS;
+	if(HAL_KEYS1)
+		inputs |= INPUT_KEYS1;
+	if(HAL_KEYS2)
+		inputs |= INPUT_KEYS2;
+	if(HAL_KEYS3)
+		inputs |= INPUT_KEYS3;
+	return inputs;
 }
-void guitarEShape(byte ofs, byte extension, byte *chord)
+
+// busy wait for a number of timer 2 counts (timer must be free
+// running with period 0xff)
+void waitCounts(byte counts)
 {
-	chord[0] = 40 + ofs;
-	chord[1] = 47 + ofs;
-	chord[2] = 52 + ofs + 2 * (extension == ADD_9);
-	chord[3] = 56 + ofs  + (extension == SUS_4);
-	chord[4] = 59 + ofs + 2 * (extension == ADD_6);
-	chord[5] = 64 + ofs;
+	byte start = HAL_TMR2;
+	while((byte)(HAL_TMR2 - start) < counts)
+		HAL_IDLE();
 }
-void guitarEmShape(byte ofs, byte extension, byte *chord)
+
+// Step the walking bit on to column col and measure how long
+// until the inputs in mask read as expected. Returns the time in
+// timer 2 counts, or SETTLE_NOT_MEASURED if they did not get there
+#define SETTLE_NOT_MEASURED 0xff
+byte timeTransition(byte col, byte mask, byte expect)
 {
-	chord[0] = 40 + ofs;
-	chord[1] = 47 + ofs;
-	chord[2] = 52 + ofs + 2 * (extension == ADD_9);
-	chord[3] = 55 + ofs  + 2 * (extension == SUS_4);
-	chord[4] = 59 + ofs + 2 * (extension == ADD_6);
-	chord[5] = 64 + ofs;
+	byte start = HAL_TMR2;
+	byte elapsed;
+	stepColumn(col);
+	do
+	{
+		elapsed = HAL_TMR2 - start;
+		if((readInputs() & mask) == expect)
+			return elapsed;
+	} while(elapsed < 0xfe);
+	return SETTLE_NOT_MEASURED;
 }
-void guitarE7Shape(byte ofs, byte extension, byte *chord)
+
+// Keep the slowest transition seen on a column by the lines in
+// mask. A time of 0 is a measurement like any other
+#define SETTLE_KEEP(col, mask, t) { \
+	if(((mask) & INPUT_STYLUS) && (stringMax[col] == SETTLE_NOT_MEASURED || (t) > stringMax[col])) \
+		stringMax[col] = (t); \
+	if(((mask) & INPUT_KEYS) && (keyMax[col] == SETTLE_NOT_MEASURED || (t) > keyMax[col])) \
+		keyMax[col] = (t); }
+
+// Convert the slowest measured transition into a period register
+// value, with a margin of half as much again plus 8us
+byte settleFromMeasurement(byte measured)
 {
-	chord[0] = 40 + ofs;
-	chord[1] = 47 + ofs;
-	chord[2] = 50 + ofs + 4 * (extension == ADD_9);
-	chord[3] = 56 + ofs  + (extension == SUS_4);
-	chord[4] = 59 + ofs + 2 * (extension == ADD_6);
-	chord[5] = 64 + ofs;
-}
-void guitarGShape(byte ofs, byte extension, byte *chord)
-{
-	chord[0] = 43 + ofs;
-	chord[1] = 47 + ofs  + (extension == SUS_4);
-	chord[2] = 50 + ofs + 2 * (extension == ADD_6);
-	chord[3] = 55 + ofs  + 2*(extension == ADD_9);
-	chord[4] = 59 + ofs + (extension == SUS_4);
-	chord[5] = 67 + ofs;
+	unsigned int settle;
+	if(measured == SETTLE_NOT_MEASURED)
+		return SCAN_SETTLE_DEFAULT;
+	settle = measured + (measured>>1) + 4;
+	if(settle > 0xff)
+		settle = 0xff;
+	if(settle < SCAN_SETTLE_MIN)
+		settle = SCAN_SETTLE_MIN;
+	return settle;
 }
 
 ////////////////////////////////////////////////////////////
 //
-// GUITAR CHORD MAPPING
+// CALIBRATE SETTLE TIMES
+//
+// Entered with MODE held. Once MODE is released the player
+// drags the stylus slowly across every string and presses 
+// each chord button. For each contact we time how long the
+// input takes to rise when its column is switched on, and how
+// long it takes to fall when the next column is switched on. 
+// The scan goes from the last column straight back to the
+// first, so a line on the last column is timed falling with
+// one more clock step and that counts against the first.
+// Pressing MODE again stores the slowest time seen for each 
+// column (plus margin) in EEPROM. Columns that saw no contact
+// get the default, so calibrating without touching anything
+// restores the defaults
 //
 ////////////////////////////////////////////////////////////
-byte guitarChord(CHORD_SELECTION *pChordSelection, byte transpose, byte *chord)
-{	
-	memset(chord, NO_NOTE, 16);
-	switch(pChordSelection->chordType)
+void calibrateSettle()
+{
+	byte scan[16];
+	byte stringMax[16];
+	byte keyMax[16];
+	byte col, next, mask, t;
+
+	// stop the scan interrupt and let timer 2 run free
+	// so we can use it to measure time
+	HAL_TMR2IE(0);
+	HAL_PR2(0xff);
+	memset(stringMax, SETTLE_NOT_MEASURED, sizeof(stringMax));
+	memset(keyMax, SETTLE_NOT_MEASURED, sizeof(keyMax));
+
+	ledCancel();
+	HAL_LED(1);
+	while(!HAL_MODE)
+		HAL_IDLE();
+	while(HAL_MODE)
 	{
-		case CHORD_MAJ:
-			switch(pChordSelection->rootNote)
-			{
-			case ROOT_C:		guitarCShape(0, pChordSelection->extension, chord);	break;
-			case ROOT_CSHARP:  	guitarAShape(4, pChordSelection->extension, chord);	break;
-			case ROOT_D:		guitarDShape(0, pChordSelection->extension, chord);	break;
-			case ROOT_DSHARP:	guitarAShape(6, pChordSelection->extension, chord);	break;
-			case ROOT_E:		guitarEShape(0, pChordSelection->extension, chord);	break;
-			case ROOT_F:		guitarEShape(1, pChordSelection->extension, chord);	break;
-			case ROOT_FSHARP:	guitarEShape(2, pChordSelection->extension, chord);	break;
-			case ROOT_G:		guitarGShape(0, pChordSelection->extension, chord);	break;
-			case ROOT_GSHARP:	guitarEShape(4, pChordSelection->extension, chord);	break;
-			case ROOT_A:		guitarAShape(0, pChordSelection->extension, chord);	break;
-			case ROOT_ASHARP:   guitarAShape(1, pChordSelection->extension, chord);	break;
-			case ROOT_B:   		guitarAShape(2, pChordSelection->extension, chord);	break;
-			}
-			break;
-		case CHORD_MIN:
-			switch(pChordSelection->rootNote)
+		// slow scan to see which inputs are active on each column
+		for(col=0;col<16;++col)
+		{
+			selectColumn(col);
+			waitCounts(0xff);
+			scan[col] = readInputs();
+		}
+
+		for(col=0;col<16;++col)
+		{
+			// rise time of lines that come on with this column
+			mask = scan[col] & ~(col? scan[col-1] : 0);
+			if(mask)
 			{
-			case ROOT_C:		guitarAmShape(3, pChordSelection->extension, chord);	break;
-			case ROOT_CSHARP:  	guitarAmShape(4, pChordSelection->extension, chord);	break;
-			case ROOT_D:		guitarDmShape(0, pChordSelection->extension, chord);	break;
-			case ROOT_DSHARP:	guitarAmShape(6, pChordSelection->extension, chord);	break;
-			case ROOT_E:		guitarEmShape(0, pChordSelection->extension, chord);	break;
-			case ROOT_F:		guitarEmShape(1, pChordSelection->extension, chord);	break;
-			case ROOT_FSHARP:	guitarEmShape(2, pChordSelection->extension, chord);	break;
-			case ROOT_G:		guitarEmShape(3, pChordSelection->extension, chord);	break;
-			case ROOT_GSHARP:	guitarEmShape(4, pChordSelection->extension, chord);	break;
-			case ROOT_A:		guitarAmShape(0, pChordSelection->extension, chord);	break;
-			case ROOT_ASHARP:   guitarAmShape(1, pChordSelection->extension, chord);	break;
-			case ROOT_B:   		guitarAmShape(2, pChordSelection->extension, chord);	break;
+				selectColumn(col? col-1 : NO_SELECTION);
+				waitCounts(0xff);
+				t = timeTransition(col, mask, mask);
+				if(t != SETTLE_NOT_MEASURED)
+					SETTLE_KEEP(col, mask, t);
 			}
-			break;
-		case CHORD_DOM7:
-			switch(pChordSelection->rootNote)
+
+			// fall time of lines that go off with the next column.
+			// After the last column, stepping on once more takes
+			// the bit off the outputs
+			next = (col + 1) & 0x0f;
+			mask = scan[col] & ~scan[next];
+			if(mask)
 			{
-			case ROOT_C:		guitarC7Shape(0, pChordSelection->extension, chord);	break;
-			case ROOT_CSHARP:  	guitarA7Shape(4, pChordSelection->extension, chord);	break;
-			case ROOT_D:		guitarD7Shape(0, pChordSelection->extension, chord);	break;
-			case ROOT_DSHARP:	guitarA7Shape(6, pChordSelection->extension, chord);	break;
-			case ROOT_E:		guitarE7Shape(0, pChordSelection->extension, chord);	break;
-			case ROOT_F:		guitarE7Shape(1, pChordSelection->extension, chord);	break;
-			case ROOT_FSHARP:	guitarE7Shape(2, pChordSelection->extension, chord);	break;
-			case ROOT_G:		guitarE7Shape(3, pChordSelection->extension, chord);	break;
-			case ROOT_GSHARP:	guitarE7Shape(4, pChordSelection->extension, chord);	break;
-			case ROOT_A:		guitarA7Shape(0, pChordSelection->extension, chord);	break;
-			case ROOT_ASHARP:   guitarA7Shape(1, pChordSelection->extension, chord);	break;
-			case ROOT_B:   		guitarA7Shape(2, pChordSelection->extension, chord);	break;
+				selectColumn(col);
+				waitCounts(0xff);
+				t = timeTransition(col+1, mask, 0);
+				if(t != SETTLE_NOT_MEASURED)
+					SETTLE_KEEP(next, mask, t);
 			}
-			break;
-		default:
-			return 0;
-	}	
-	for(int i=0;i<16;++i)
-		if(chord[i] != NO_NOTE)
-			chord[i] += transpose;
-	return 6;
+		}
+
+		// flicker the LED while there is something to measure
+		byte active = 0;
+		for(col=0;col<16;++col)
+			active |= scan[col];
+		HAL_LED(!active);
+	}
+
+	// store the results
+	while(HAL_EEPROM_BUSY)
+		HAL_IDLE();
+	for(col=0;col<16;++col)
+	{
+		stringSettle[col] = settleFromMeasurement(stringMax[col]);
+		keySettle[col] = settleFromMeasurement(keyMax[col]);
+		eeprom_write(EEPROM_ADDR_STRING_SETTLE + col, stringSettle[col]);
+		eeprom_write(EEPROM_ADDR_KEY_SETTLE + col, keySettle[col]);
+	}
+	eeprom_write(EEPROM_ADDR_SETTLE_COOKIE, EEPROM_SETTLE_COOKIE);
+	HAL_LED(0);
+	ledQueueBlink(200, 0, 1);
+
+	// wait for MODE release and carry on scanning
+	while(!HAL_MODE)
+		HAL_IDLE();
+	initScan();
 }
 
 ////////////////////////////////////////////////////////////
 //
-// MAKE A CHORD BY "STACKING TRIADS"
+// MIDI IN
+// Parses each byte as the interrupt receives it, and passes
+// whole messages on to the thru queue
 //
 ////////////////////////////////////////////////////////////
-byte stackTriads(CHORD_SELECTION *pChordSelection, byte maxReps, byte transpose, byte size, byte *chord, unsigned int keys)
-{
-	byte struc[5];
-	byte len = 0;
+#ifdef MIDI_IN
+// count bytes that could not be passed on
+#define MIDI_IN_DROP(len) (midiInDropped += (midiInDropped < 0xff00)? (len) : 0)
 
-	memset(chord, NO_NOTE, 16);
-	
-	// root
-	struc[len++] = 0; 
-	
-	// added 2/9
-	if(pChordSelection->extension == ADD_9)		
-		struc[len++] = 2;
-		
-	// sus 4
-	if(pChordSelection->extension == SUS_4)	{		
-		struc[len++] = 5;
-	} else {
-		switch(pChordSelection->chordType)		
-		{		
-			// minor 3rd
-		case CHORD_MIN: case CHORD_MIN7: case CHORD_DIM: // minor 3rd
-			struc[len++] = 3;
-			break;
-		default: // major 3rd
-			struc[len++] = 4;
-			break;		
-		}
-	}
-	
-	// 5th
-	switch(pChordSelection->chordType)		
-	{
-	case CHORD_AUG:
-		struc[len++] = 8;
-		break;
-	case CHORD_DIM:
-		struc[len++] = 6;
-		break;
-	default:
-		struc[len++] = 7;
-		break;
+// Put bytes on the thru queue, all of them or none. A message
+// that does not fit is dropped, counting its status byte too
+byte midiInQueue(byte *msg, byte len)
+{
+	byte *p = &txBuffer[txBase[TXQ_THRU]];
+	byte head = txHead[TXQ_THRU];
+	if(((txTail[TXQ_THRU] - head - 1) & (TXQ_THRU_SIZE-1)) < len)
+	{
+		MIDI_IN_DROP(len);
+		return 0;
 	}
-	
-	if(pChordSelection->extension == ADD_6)		
-		struc[len++] = 9;
-			
-	// 7th
-	switch(pChordSelection->chordType)		
+	while(len--)
 	{
-	case CHORD_DOM7: case CHORD_MIN7:
-		struc[len++] = 10;
-		break;
-	case CHORD_MAJ7:
-		struc[len++] = 11;
-		break;				
+		p[head] = *msg++;
+		head = (head + 1) & (TXQ_THRU_SIZE-1);
 	}
+	txHead[TXQ_THRU] = head;
+	HAL_TXIE(1);
+	return 1;
+}
 
-	// fill the chord array with MIDI notes
-	byte root = pChordSelection->rootNote + transpose;
-	int from = 0;
-	int to = 0;
-	unsigned int keyBit = 1;
-	while(to < size)
+void midiInByte(byte c)
+{
+	byte len;
+	midiInTick = sysTicks;
+
+	// realtime, which can come between the bytes of any other
+	// message and does not affect running status
+	if(c >= 0xf8)
 	{
-		if(!keys || (keys & keyBit)) {
-			chord[to++] = root+struc[from];		
+		if(midiInRealtime)
+		{
+			MIDI_IN_DROP(1);
+		}
+		else
+		{
+			midiInRealtime = c;
+			HAL_TXIE(1);
+		}
+		return;
+	}
+
+	// SysEx bytes are passed on as they come. If one does not fit
+	// the rest of the SysEx is dropped, and the interrupt ends it
+	// once what was queued has gone
+	if(midiInStatus == 0xf0 && (c < 0x80 || c == 0xf7))
+	{
+		if(!midiInQueue(&c, 1) || c == 0xf7)
+			midiInStatus = 0;
+		return;
+	}
+
+	if(c & 0x80)
+	{
+		// any other status byte ends a SysEx
+		midiInStatus = c;
+		midiInMsg[0] = c;
+		midiInCount = 1;
+		if(c == 0xf0)
+		{
+			if(!midiInQueue(&c, 1))
+				midiInStatus = 0;
+			return;
+		}
+		if(c == 0xf7)
+		{
+			// end of a SysEx we were not passing on
+			midiInStatus = 0;
+			MIDI_IN_DROP(1);
+			return;
+		}
+	}
+	else if(!midiInStatus)
+	{
+		// data with no status to go with it
+		MIDI_IN_DROP(1);
+		return;
+	}
+	else
+	{
+		midiInMsg[midiInCount++] = c;
+	}
+
+	// data bytes the message needs
+	len = 2;
+	if((midiInStatus & 0xe0) == 0xc0 || midiInStatus == 0xf1 || midiInStatus == 0xf3)
+		len = 1;
+	else if(midiInStatus >= 0xf0 && midiInStatus != 0xf2)
+		len = 0;
+	if(midiInCount > len)
+	{
+		// complete, and the next data byte starts another one with
+		// the same status. System common messages have no running
+		// status
+		midiInQueue(midiInMsg, midiInCount);
+		midiInCount = 1;
+		if(midiInStatus >= 0xf0)
+			midiInStatus = 0;
+	}
+}
+#endif // MIDI_IN
+
+////////////////////////////////////////////////////////////
+//
+// INTERRUPT HANDLER
+//
+////////////////////////////////////////////////////////////
+void interrupt(void)
+{
+	// System tick
+	if(HAL_TMR0IF)
+	{
+		HAL_TMR0IF_CLEAR();
+		++sysTicks;
+
+#ifdef MIDI_IN
+		// a SysEx from MIDI in holds up our own output, so give
+		// up on one if the input goes quiet part way through it.
+		// This has to be done here, as the main loop may be
+		// waiting for queue space that only the output can free
+		if(midiInStatus == 0xf0 && (byte)(sysTicks - midiInTick) >= MIDI_IN_TIMEOUT)
+		{
+			midiInStatus = 0;
+			HAL_TXIE(1);
+		}
+#endif
+	}
+
+	// String scan timer (which is stopped during calibration)
+	if(HAL_TMR2IE_ON && HAL_TMR2IF)
+	{
+		HAL_TMR2IF_CLEAR();
+		SCAN_FRAME *frame = &scanFrames[scanWrite];
+
+		// sample the inputs for the column that has been settling
+		if(HAL_STYLUS)
+			frame->stylus |= scanBit;
+		if(scanKeys)
+		{
+			if(HAL_KEYS1)
+				frame->keys[0] |= scanBit;
+			if(HAL_KEYS2)
+				frame->keys[1] |= scanBit;
+			if(HAL_KEYS3)
+				frame->keys[2] |= scanBit;
+		}
+
+		// clock the next column on so it can settle until the next
+		// tick. Outputs show the shift register from before the clock
+		// pulse, so the walking bit goes back in as we move to the last
+		// column in order to appear on the first column after it. The 
+		// MSSP is given the first byte of the pattern here and the 
+		// second once it has gone, below
+		byte next = (scanStep + 1) & 0x0f;
+#ifdef SCAN_SPI
+		HAL_SSPIF_CLEAR();
+		HAL_SSPBUF(scanPatternHigh[next]);
+#else
+		if(scanStep == 14)
+			HAL_DS(1);
+		HAL_CLK(0);
+		HAL_CLK(1);
+		HAL_DS(0);
+#endif
+
+		// a new frame starts with the next column, so decide now 
+		// whether it scans the chord buttons
+		if(!next)
+		{
+			scanKeys = ((byte)(sysTicks - keyScanTick) >= keyScanTicks);
+			if(scanKeys)
+				keyScanTick = sysTicks;
+		}
+
+		// timer 2 restarted when it matched, so setting the period now
+		// gives the new column its own settle time
+		byte settle = scanKeys? scanPeriod[next] : stringSettle[next];
+		HAL_PR2(settle);
+		scanFrameTicks += settle + 1;
+
+		// note the time of the first column
+		if(!scanStep)
+			READ_TIMER1(frame->stamp);
+
+		if(++scanStep < 16)
+		{
+			scanBit <<= 1;
+		}
+		else
+		{
+			// frame is complete. If pollIO has not finished with the last
+			// one then this one gets dropped and the buffer is reused
+			frame->mode = !HAL_MODE;
+			if(scanFrameReady)
+			{
+				++scanOverruns;
+			}
+			else
+			{
+				scanWrite ^= 1;
+				scanFrameReady = 1;
+				frame = &scanFrames[scanWrite];
+			}
+			frame->stylus = 0;
+			frame->keys[0] = 0;
+			frame->keys[1] = 0;
+			frame->keys[2] = 0;
+			frame->keysScanned = scanKeys;
+			scanStep = 0;
+			scanBit = 1;
+
+			// scan rate
+			++scanCount;
+			scanClock += scanFrameTicks;
+			scanFrameTicks = 0;
+			if(scanClock >= 1000000/SCAN_TICK_US)
+			{
+				scanClock -= 1000000/SCAN_TICK_US;
+				scansPerSecond = scanCount;
+				scanCount = 0;
+			}
+		}
+
+#ifdef SCAN_SPI
+		while(!HAL_SSPIF)
+			HAL_IDLE();
+		HAL_SSPBUF(scanPatternLow[next]);
+#endif
+	}
+
+#ifdef MIDI_IN
+	// MIDI in. The receive FIFO holds two bytes, and if a third
+	// comes in before they are read the receiver stops until it
+	// is reset, losing at least one byte
+	if(HAL_RCIF)
+	{
+		while(HAL_RCIF)
+		{
+			byte framingError = HAL_FERR;	// must be read before RCREG
+			byte c = HAL_RCREG;
+			if(framingError)
+				MIDI_IN_DROP(1);
+			else
+				midiInByte(c);
+		}
+		if(HAL_OERR)
+		{
+			HAL_CREN(0);
+			HAL_CREN(1);
+			MIDI_IN_DROP(1);
+		}
+	}
+#endif
+
+	// USART ready for another byte?
+	if(HAL_TXIE_ON && HAL_TXIF)
+	{
+		byte q = txQueue;
+		if(!txRemain && !txSysex)
+		{
+			// between messages, so take the next one from the
+			// most urgent queue
+			for(q=0; q<TXQ_OTHER; ++q)
+				if(txHead[q] != txTail[q])
+					break;
+			txQueue = q;
+		}
+		if(midiInRealtime)
+		{
+			HAL_TXREG(midiInRealtime);
+			midiInRealtime = 0;
+		}
+		else if(txHead[q] == txTail[q])
+		{
+			if(txSysex && q == TXQ_THRU && midiInStatus != 0xf0)
+			{
+				// the SysEx coming in was cut short or timed out
+				HAL_TXREG(0xf7);
+				txSysex = 0;
+			}
+			else
+			{
+				// nothing more to send (for now, if part way 
+				// through a SysEx)
+				HAL_TXIE(0);
+				if(!ledBusy)
+					HAL_LED(0);
+			}
+		}
+		else
+		{
+			byte *p = &txBuffer[txBase[q]];
+			byte c = p[txTail[q]];
+			if(txRemain)
+			{
+				--txRemain;
+			}
+			else
+			{
+#ifdef PERF_STATS
+				// is this the start of a note being timed?
+				if(latencyState == LATENCY_QUEUED && q == latencyQueue && txTail[q] == latencyPos)
+				{
+					READ_TIMER1(latencyEnd);
+					latencyState = LATENCY_SENT;
+				}
+#endif
+				if(c >= 0xf0)
+				{
+					// SysEx start or end, or system common from MIDI
+					// in, which cancels running status
+					txSysex = (c == 0xf0);
+					runningStatus = 0;
+					if(c == 0xf2)
+						txRemain = 2;
+					else if(c == 0xf1 || c == 0xf3)
+						txRemain = 1;
+				}
+				else if(c & 0x80)
+				{
+					// channel message, of which the whole is queued.
+					// From MIDI in this may also end a SysEx
+					txSysex = 0;
+					txRemain = ((c & 0xe0) == 0xc0)? 1 : 2;
+#if MIDI_STATUS_REFRESH
+					if(c == runningStatus && --runningStatusCount)
+#else
+					if(c == runningStatus)
+#endif
+					{
+						// running status, so go straight to the first data byte
+						txTail[q] = (txTail[q] + 1) & txMask[q];
+						c = p[txTail[q]];
+						--txRemain;
+					}
+					else
+					{
+						runningStatus = c;
+						runningStatusCount = MIDI_STATUS_REFRESH;
+					}
+				}
+			}
+			HAL_TXREG(c);
+			txTail[q] = (txTail[q] + 1) & txMask[q];
+		}
+	}
+}
+
+////////////////////////////////////////////////////////////
+//
+// MIDI TRANSMIT QUEUES
+//
+////////////////////////////////////////////////////////////
+
+// bytes waiting in all the queues
+byte txPending()
+{
+	byte q, n = 0;
+	for(q=0; q<TXQ_COUNT; ++q)
+		n += (txHead[q] - txTail[q]) & txMask[q];
+	return n;
+}
+
+// bytes free in a queue
+byte txSpace(byte q)
+{
+	return (txTail[q] - txHead[q] - 1) & txMask[q];
+}
+
+// Wait until there is room for len bytes in a queue. If it is 
+// full we have no choice but to wait for the interrupt 
+void txReserve(byte q, byte len)
+{
+	if(txSpace(q) < len)
+	{
+		if(txOverflows != 0xffff)
+			++txOverflows;
+		while(txSpace(q) < len)
+			HAL_IDLE();
+	}
+}
+
+// Hand bytes written after the head of a queue to the interrupt
+void txCommit(byte q, byte len)
+{
+	txHead[q] = (txHead[q] + len) & txMask[q];
+	byte depth = txPending();
+	if(depth > txHighWater)
+		txHighWater = depth;
+
+	// LED stays lit until the queues have drained
+	ledIdle(1);
+	HAL_TXIE(1);
+}
+
+// Queue a whole 3 byte channel message
+void queueMessage(byte q, byte status, byte data1, byte data2)
+{
+	byte *p = &txBuffer[txBase[q]];
+	byte mask = txMask[q];
+	byte head;
+	txReserve(q, 3);
+	head = txHead[q];
+	p[head] = status;
+	p[(head + 1) & mask] = data1;
+	p[(head + 2) & mask] = data2;
+	txCommit(q, 3);
+}
+
+// Queue a SysEx byte, in order with note offs
+void send(unsigned char c)
+{
+	txReserve(TXQ_OTHER, 1);
+	txBuffer[txBase[TXQ_OTHER] + txHead[TXQ_OTHER]] = c;
+	txCommit(TXQ_OTHER, 1);
+}
+
+////////////////////////////////////////////////////////////
+//
+// NOTE SETS
+//
+////////////////////////////////////////////////////////////
+void noteSetAdd(NOTESET *set, byte note)
+{
+	if(note != NO_NOTE)
+		set->bits[(note>>3)&0x0f] |= (1<<(note&7));
+}
+
+void noteSetRemove(NOTESET *set, byte note)
+{
+	set->bits[(note>>3)&0x0f] &= ~(1<<(note&7));
+}
+
+// make a set from an array of notes padded with NO_NOTE
+void noteSetFromNotes(NOTESET *set, byte *notes)
+{
+	byte i;
+	memset(set, 0, sizeof(NOTESET));
+	for(i=0;i<16;++i)
+		noteSetAdd(set, notes[i]);
+}
+
+////////////////////////////////////////////////////////////
+//
+// QUEUE A NOTE ON (IN QUEUE q) OR NOTE OFF (VALUE 0) FOR
+// THE LAYER WHOSE NOTES ARE IN sounding
+//
+////////////////////////////////////////////////////////////
+void queueNote(byte q, NOTESET *sounding, byte channel, byte note, byte value)
+{
+	note &= 0x7f;
+	
+	// once everything queued in order has gone, nothing is pending
+	if(txHead[TXQ_OTHER] == txTail[TXQ_OTHER])
+	{
+		memset(&txOffPending, 0, sizeof(NOTESET));
+		txOrderAll = 0;
+	}
+	if(!value)
+	{
+		noteSetRemove(sounding, note);
+		noteSetAdd(&txOffPending, note);
+		q = TXQ_OTHER;
+	}
+	else 
+	{
+		noteSetAdd(sounding, note);
+		if(txOrderAll || (txOffPending.bits[note>>3] & (1<<(note&7))))
+			q = TXQ_OTHER;
+#ifdef PERF_STATS
+		if(latencyState == LATENCY_ARMED)
+		{
+			latencyQueue = q;
+			latencyPos = txHead[q];
+			latencyState = LATENCY_QUEUED;
+		}
+#endif
+	}
+	queueMessage(q, 0x90 | channel, note, value&0x7f);
+}
+
+////////////////////////////////////////////////////////////
+//
+// START NOTE MESSAGE (FOR A STRING)
+//
+////////////////////////////////////////////////////////////
+void startNote(byte channel, byte note, byte value)
+{
+	queueNote(TXQ_STRING, &playSounding, channel, note, value);
+}
+
+////////////////////////////////////////////////////////////
+//
+// STOP NOTE MESSAGE (FOR A STRING)
+//
+////////////////////////////////////////////////////////////
+void stopNote(byte channel, byte note)
+{
+	queueNote(TXQ_OTHER, &playSounding, channel, note, 0);
+}
+
+////////////////////////////////////////////////////////////
+//
+// CONTROL CHANGE MESSAGE
+//
+////////////////////////////////////////////////////////////
+void sendCC(byte channel, byte controller, byte value)
+{
+	txOrderAll = 1;
+	queueMessage(TXQ_OTHER, 0xb0 | channel, controller&0x7f, value&0x7f);
+}
+
+////////////////////////////////////////////////////////////
+//
+// START (OR STOP IF VELOCITY IS 0) THE NOTES SET IN ONE 
+// BYTE OF A NOTESET, LOWEST FIRST. bits 0-7 are note to
+// note+7. Sets are sent a byte at a time so that callers
+// need not build the set of changes first. Only chord layers
+// are started this way, which go out after any string notes
+//
+////////////////////////////////////////////////////////////
+void sendNoteBits(byte note, byte bits, NOTESET *sounding, byte channel, byte velocity)
+{
+	while(bits)
+	{
+		if(bits & 1)
+			queueNote(TXQ_DRONE, sounding, channel, note, velocity);
+		bits >>= 1;
+		++note;
+	}
+}
+
+
+////////////////////////////////////////////////////////////
+//
+// STOP THE NOTES WE STARTED ON A CHANNEL
+//
+////////////////////////////////////////////////////////////
+void stopSoundingNotes(byte channel, NOTESET *sounding)
+{
+	byte i;
+	for(i=0;i<16;++i)
+		sendNoteBits(i<<3, sounding->bits[i], sounding, channel, 0);
+}
+
+////////////////////////////////////////////////////////////
+//
+// PERFORMANCE HISTOGRAMS
+//
+////////////////////////////////////////////////////////////
+#ifdef PERF_STATS
+void histAdd(byte hist, word value)
+{
+	byte bucket = 0;
+	while(value && bucket < HIST_BUCKETS-1)
+	{
+		++bucket;
+		value >>= 1;
+	}
+	byte *p = &histograms[hist * HIST_BUCKETS + bucket];
+	if(*p < 0x7f)
+		++*p;
+}
+
+// Start timing a note from when its string was sampled, unless
+// one is already being timed. queueNote notes where it goes
+void latencyMark(word t)
+{
+	if(latencyState == LATENCY_IDLE)
+	{
+		latencyStart = t;
+		latencyState = LATENCY_ARMED;
+	}
+}
+#else
+#define histAdd(hist, value)
+#define latencyMark(t)
+#endif
+
+////////////////////////////////////////////////////////////
+//
+// DUMP THE HISTOGRAMS AS SYSEX AND START AGAIN
+// F0 7D 4C 53 01 <hist> <HIST_COUNT> <HIST_BUCKETS> <counts..> F7
+// for each histogram (with PERF_STATS), then
+// F0 7D 4C 53 03 <dropped> F7
+// 7D is the non-commercial manufacturer ID, 4C 53 is "LS"
+// and 01 and 03 are the message types. <dropped> is the count
+// of bytes lost from MIDI in, sent as 3 bytes, low 7 bits
+// first. A histogram is cleared as it is sent
+//
+////////////////////////////////////////////////////////////
+void sendWord7(word value)
+{
+	send(value & 0x7f);
+	send((value >> 7) & 0x7f);
+	send(value >> 14);
+}
+
+void sendSysexHeader(byte type)
+{
+	send(0xf0);
+	send(0x7d);
+	send(0x4c);
+	send(0x53);
+	send(type);
+}
+
+void sendStats()
+{
+	if(statsNext == STATS_IDLE)
+		statsNext = STATS_FIRST;
+	ledQueueBlink(5, 5, 2);
+}
+
+// Send the next message of the dump once the queue is empty.
+// Called on every pass of the main loop
+void serviceStats()
+{
+	if(statsNext == STATS_IDLE || txHead[TXQ_OTHER] != txTail[TXQ_OTHER])
+		return;
+#ifdef PERF_STATS
+	if(statsNext < HIST_COUNT)
+	{
+		byte i;
+		byte *p = &histograms[statsNext * HIST_BUCKETS];
+		sendSysexHeader(0x01);
+		send(statsNext);
+		send(HIST_COUNT);
+		send(HIST_BUCKETS);
+		for(i=0; i<HIST_BUCKETS; ++i)
+		{
+			send(p[i]);
+			p[i] = 0;
+		}
+		send(0xf7);
+		++statsNext;
+		return;
+	}
+#endif
+
+	// the interrupt adds to the count, so take it with
+	// interrupts off
+	word dropped;
+	HAL_GIE(0);
+	dropped = midiInDropped;
+	midiInDropped = 0;
+	HAL_GIE(1);
+	sendSysexHeader(0x03);
+	sendWord7(dropped);
+	send(0xf7);
+	statsNext = STATS_IDLE;
+}
+
+#ifdef SCAN_TRACE
+////////////////////////////////////////////////////////////
+//
+// SEND A SCAN FRAME AS SYSEX FOR A TRACE CAPTURE
+// F0 7D 4C 53 02 <stamp> <stylus> <keys1> <keys2> <keys3> <mode> F7
+// Each 16 bit value is sent as 3 bytes, low 7 bits first
+//
+////////////////////////////////////////////////////////////
+void traceFrame(SCAN_FRAME *frame)
+{
+	byte i;
+	if(frame->stylus == traceLast.stylus &&
+		frame->keys[0] == traceLast.keys[0] &&
+		frame->keys[1] == traceLast.keys[1] &&
+		frame->keys[2] == traceLast.keys[2] &&
+		frame->mode == traceLast.mode &&
+		!traceMissed.stylus && !traceMissed.mode &&
+		!(traceMissed.keys[0] | traceMissed.keys[1] | traceMissed.keys[2]) &&
+		++traceIdle < TRACE_IDLE_FRAMES)
+		return;
+
+	// merge in anything missed, and if there is still no room
+	// then leave it for the next frame
+	traceLast.stylus = frame->stylus | traceMissed.stylus;
+	for(i=0; i<3; ++i)
+		traceLast.keys[i] = frame->keys[i] | traceMissed.keys[i];
+	traceLast.mode = frame->mode | traceMissed.mode;
+	traceLast.stamp = frame->stamp;
+	if(txSpace(TXQ_OTHER) < TRACE_SYSEX_LEN)
+	{
+		traceMissed = traceLast;
+		return;
+	}
+	memset(&traceMissed, 0, sizeof(SCAN_FRAME));
+	traceIdle = 0;
+	frame = &traceLast;
+	sendSysexHeader(0x02);
+	sendWord7(frame->stamp);
+	sendWord7(frame->stylus);
+	sendWord7(frame->keys[0]);
+	sendWord7(frame->keys[1]);
+	sendWord7(frame->keys[2]);
+	send(!!frame->mode);
+	send(0xf7);
+}
+#endif // SCAN_TRACE
+
+////////////////////////////////////////////////////////////
+//
+// MIDI PANIC
+// Stops the notes we started on each layer's channel and
+// follows up with All Notes Off and All Sound Off in case the
+// receiver has anything else hanging
+//
+////////////////////////////////////////////////////////////
+void midiPanic()
+{
+	panicStep = 0;
+}
+
+// Send the next part of the panic once there is room for it.
+// Called on every pass of the main loop
+void servicePanic()
+{
+	byte drone = panicStep & PANIC_DRONE;
+	byte i = panicStep & ~PANIC_DRONE;
+	byte channel = drone? droneChannel : playChannel;
+	NOTESET *sounding = drone? &droneSounding : &playSounding;
+	if(panicStep == PANIC_IDLE || txSpace(TXQ_OTHER) < PANIC_NOTES_LEN)
+		return;
+	if(i < 16)
+	{
+		sendNoteBits(i<<3, sounding->bits[i], sounding, channel, 0);
+		++panicStep;
+		return;
+	}
+
+	// the drone's channel is only cleared once if it is shared
+	if(!drone || droneChannel != playChannel)
+	{
+		sendCC(channel, 123, 0);	// All Notes Off
+		sendCC(channel, 120, 0);	// All Sound Off
+	}
+	panicStep = drone? PANIC_IDLE : PANIC_DRONE;
+}
+
+////////////////////////////////////////////////////////////
+//
+// MOVE THE LAYERS TO NEW CHANNELS
+// A layer's notes are stopped on its old channel when it
+// moves. The drone's are also stopped when the play layer
+// moves onto its channel, so that the two never have the
+// same note sounding on one channel
+//
+////////////////////////////////////////////////////////////
+void setChannels(byte play, byte drone)
+{
+	if(play != playChannel)
+		stopSoundingNotes(playChannel, &playSounding);
+	if(drone != droneChannel || (drone == play && play != playChannel))
+		stopSoundingNotes(droneChannel, &droneSounding);
+	playChannel = play;
+	droneChannel = drone;
+}
+
+////////////////////////////////////////////////////////////
+//
+// SET PLAY CHANNEL
+//
+////////////////////////////////////////////////////////////
+void setPlayChannel(byte c)
+{
+	c &= 0xF;
+	setChannels(c, droneChannel);
+	journalDirty = 1;
+	ledQueueBlink(200, 0, 1);	// 2 seconds
+}
+
+////////////////////////////////////////////////////////////
+//
+// SET DRONE CHANNEL
+//
+////////////////////////////////////////////////////////////
+void setDroneChannel(byte c)
+{
+	c &= 0xF;
+	setChannels(playChannel, c);
+	journalDirty = 1;
+	ledQueueBlink(200, 0, 1);	// 2 seconds
+}
+
+////////////////////////////////////////////////////////////
+//
+// GUITAR CHORD MAPPING
+// The voicings are looked up in tables generated from the
+// reference chord shapes in host/genvoicings.c
+//
+////////////////////////////////////////////////////////////
+byte guitarVoicing(byte extension, byte index)
+{
+	switch(extension)
+	{
+		case SUS_4:	return guitarVoicingsSus4[index];
+		case ADD_6:	return guitarVoicingsAdd6[index];
+		case ADD_9:	return guitarVoicingsAdd9[index];
+		default:	return guitarVoicingsNone[index];
+	}
+}
+
+byte guitarChord(CHORD_SELECTION *pChordSelection, byte transpose, byte *chord)
+{	
+	byte i, index, bass, note;
+	memset(chord, NO_NOTE, 16);
+	if(pChordSelection->extension > ADD_9)
+		return 0;
+	switch(pChordSelection->chordType)
+	{
+		case CHORD_MAJ:		index = 0;	break;
+		case CHORD_MIN:		index = 12;	break;
+		case CHORD_DOM7:	index = 24;	break;
+		default:
+			return 0;
+	}	
+
+	// there are no shapes for columns 13-16, which stay silent
+	if(pChordSelection->rootNote >= 12)
+		return 6;
+	index += pChordSelection->rootNote;
+	bass = (options & OPT_GUITARBASSNOTES)? 0 : guitarBassStrings[index];
+	index *= 6;
+	for(i=0;i<6;++i)
+	{
+		note = guitarVoicing(pChordSelection->extension, index + i);
+		if(note != NO_NOTE && !(bass & 1))
+			chord[i] = note + transpose;
+		bass >>= 1;
+	}
+	return 6;
+}
+
+////////////////////////////////////////////////////////////
+//
+// MAKE A CHORD BY "STACKING TRIADS"
+//
+// The notes of a chord are a 12 bit interval mask, as for a
+// scale, taken from chordIntervals for the chord type. The
+// extension then clears and adds intervals with the masks
+// in chordExtensions, and for EXT_9TH adds the 7th that
+// suits the chord type from chordSevenths. The intervals
+// are stacked up an octave at a time to fill the strings.
+// The tables are in ChordIntervals.h, generated from the
+// interval lists in host/genchords.c, so a new chord quality
+// only needs a new row there
+//
+////////////////////////////////////////////////////////////
+
+// Entry i of a table of 2 byte entries
+#define ROM_WORD(table, i) ((unsigned int)(byte)(table)[2*(i)]<<8 | (byte)(table)[2*(i)+1])
+
+unsigned int chordMask(CHORD_SELECTION *pChordSelection)
+{
+	byte type = pChordSelection->chordType;
+	byte ext = pChordSelection->extension * 3;
+	unsigned int mask = ROM_WORD(chordIntervals, type);
+	mask &= ~ROM_WORD(chordExtensions, ext);
+	mask |= ROM_WORD(chordExtensions, ext+1);
+	mask |= ROM_WORD(chordSevenths, type) & ROM_WORD(chordExtensions, ext+2);
+	return mask;
+}
+
+byte stackTriads(CHORD_SELECTION *pChordSelection, byte maxReps, byte transpose, byte size, byte *chord, unsigned int keys)
+{
+	byte struc[12];
+	byte len = 0;
+	byte i;
+
+	memset(chord, NO_NOTE, 16);
+
+	// the intervals of the chord, lowest first
+	unsigned int mask = chordMask(pChordSelection);
+	for(i=0; mask; ++i)
+	{
+		struc[len] = i;
+		len += (mask & 1);
+		mask >>= 1;
+	}
+
+	// fill the chord array with MIDI notes
+	byte root = pChordSelection->rootNote + transpose;
+	int from = 0;
+	int to = 0;
+	unsigned int keyBit = 1;
+	while(to < size)
+	{
+		if(!keys || (keys & keyBit)) {
+			chord[to++] = root+struc[from];		
 		}
 		if(++from >= len)
 		{
@@ -781,238 +2408,728 @@ byte stackTriads(CHORD_SELECTION *pChordSelection, byte maxReps, byte transpose,
 		}
 		keyBit<<=1;
 	}
-	return to;
+	return to;
+}
+
+////////////////////////////////////////////////////////////
+//
+// SCALE ENGINE
+//
+// A scale is a 12 bit mask with bit n set if the note n
+// semitones above the root is in it. When the scale changes
+// the strings it covers are worked out for every root into
+// scaleStrings[], so mapping it to the strings for a chord is
+// just a lookup. Besides the built-in scales, one of a bank
+// of SCALE_SLOTS user scales in EEPROM can be selected. The
+// bank is filled with defaultScales on first power on
+//
+////////////////////////////////////////////////////////////
+#define SCALE_CHROMATIC		0x0fff
+#define SCALE_MAJOR			0x0ab5
+#define SCALE_MINOR			0x05ad
+#define SCALE_PENTATONIC	0x0295
+#define SCALE_SLOTS 12
+
+// Major, dorian, phrygian, lydian, mixolydian, minor, locrian,
+// harmonic minor, melodic minor, blues, minor pentatonic and 
+// whole tone, high byte first
+rom char *defaultScales = 
+	"\x0a\xb5\x06\xad\x05\xab\x0a\xd5\x06\xb5\x05\xad"
+	"\x05\x6b\x09\xad\x0a\xad\x04\xe9\x04\xa9\x05\x55";
+
+unsigned int scaleMask = 0;			// the scale in scaleStrings
+unsigned int scaleStrings[12];		// bit for each string in the scale, by root
+unsigned int scaleBankMask = 0;		// the selected bank scale, 0 if none
+
+void buildScale(unsigned int mask)
+{
+	byte root;
+	unsigned int rotated = mask;
+	for(root=0; root<12; ++root)
+	{
+		// the 16 strings span an octave and a 4th
+		scaleStrings[root] = rotated | (rotated << 12);
+		
+		// rotate left within 12 bits for the next root up
+		rotated <<= 1;
+		if(rotated & 0x1000)
+			rotated ^= 0x1001;
+	}
+	scaleMask = mask;
+}
+
+// transpose is the note of the first string and must be a
+// whole number of octaves
+byte makeScale(byte root, byte transpose, unsigned int mask, byte *chord)
+{
+	byte i;
+	if(root == NO_NOTE)
+	{
+		// columns 13-16 have no root with the circle of fifths
+		memset(chord, NO_NOTE, 16);
+		return 0;
+	}
+	if(root >= 12)
+		root -= 12;		// columns 13-16 play the scale of 1-4
+	if(mask != scaleMask)
+		buildScale(mask);
+	unsigned int inScale = scaleStrings[root];
+	for(i=0; i<16; ++i)
+	{
+		chord[i] = (inScale & 1)? transpose + i : NO_NOTE;
+		inScale >>= 1;
+	}
+	return 16;
+}
+
+void initScaleBank()
+{
+	byte i;
+	if(eepromRead(EEPROM_ADDR_SCALE_COOKIE) == EEPROM_SCALE_COOKIE)
+		return;
+	for(i=0; i<2*SCALE_SLOTS; ++i)
+		eeprom_write(EEPROM_ADDR_SCALES + i, defaultScales[i]);
+	eeprom_write(EEPROM_ADDR_SCALE_COOKIE, EEPROM_SCALE_COOKIE);
+}
+
+// Read the selected bank scale from EEPROM into scaleBankMask
+void loadScale()
+{
+	byte slot = (settings & SETTING_SCALE) >> SETTING_SCALE_SHIFT;
+	scaleBankMask = 0;
+	if(!slot || slot > SCALE_SLOTS)
+		return;
+	byte addr = EEPROM_ADDR_SCALES + 2*(slot-1);
+	scaleBankMask = ((unsigned int)eepromRead(addr)<<8 | eepromRead(addr+1)) & SCALE_CHROMATIC;
+}
+
+////////////////////////////////////////////////////////////
+//
+// SELECT A SCALE FROM THE BANK
+// Slot 1 to SCALE_SLOTS, or 0 to turn the bank scale off.
+// The built-in scale options are cleared so that it is heard
+//
+////////////////////////////////////////////////////////////
+void selectScale(byte slot)
+{
+	if(slot > SCALE_SLOTS)
+		slot = 0;
+	settings &= ~SETTING_SCALE;
+	settings |= (unsigned int)slot << SETTING_SCALE_SHIFT;
+	loadScale();
+	clearOptions(OPT_CHROMATIC|OPT_DIATONIC|OPT_PENTATONIC);
+	journalDirty = 1;
+	ledQueueBlink(1, 10, slot? 2 : 1);
+}
+
+////////////////////////////////////////////////////////////
+//
+// START PLAYING THE NOTES OF THE NEW CHORD
+// Stops the old notes (only those still sounding) and starts
+// the new ones if velocity is nonzero. With sustainCommon 
+// the notes in both chords carry on without a retrigger.
+// The changes are sent 8 notes at a time as they are worked 
+// out rather than built up as a set
+//
+////////////////////////////////////////////////////////////
+void playChordNotes(NOTESET *oldNotes, NOTESET *newNotes, NOTESET *sounding, byte channel, byte velocity, byte sustainCommon)
+{
+	byte i, keep;
+	
+	// Start by silencing old notes which are not carrying on
+	for(i=0;i<16;++i)
+	{
+		keep = sustainCommon? newNotes->bits[i] : 0;
+		sendNoteBits(i<<3, oldNotes->bits[i] & ~keep & sounding->bits[i], sounding, channel, 0);
+	}
+	
+	// Now play notes which are not already playing
+	if(velocity)
+	{
+		for(i=0;i<16;++i)
+		{
+			keep = sustainCommon? (oldNotes->bits[i] & sounding->bits[i]) : 0;
+			sendNoteBits(i<<3, newNotes->bits[i] & ~keep, sounding, channel, velocity);
+		}
+	}
+
+	// remember the notes
+	*oldNotes = *newNotes;
+}
+
+////////////////////////////////////////////////////////////
+//
+// RELEASE THE NOTES OF A CHORD
+//
+////////////////////////////////////////////////////////////
+void releaseChordNotes(NOTESET *oldNotes, NOTESET *sounding, byte channel, byte sustain)
+{
+	byte i;
+
+	// override allowed by sustain option
+	if(sustain)
+		return;
+		
+	// Silence notes 
+	for(i=0;i<16;++i)
+		sendNoteBits(i<<3, oldNotes->bits[i] & sounding->bits[i], sounding, channel, 0);
+	memset(oldNotes, 0, sizeof(NOTESET));
+}
+
+////////////////////////////////////////////////////////////
+//
+// CALCULATE NOTES FOR A CHORD SHAPE AND MAP THEM TO THE 
+// STRINGS, AND THE NOTES OF THE DRONE CHORD
+//
+////////////////////////////////////////////////////////////
+void calculateChord(CHORD_SELECTION *pChordSelection, byte *notes, NOTESET *drone)
+{
+	int i;
+
+	// drone chord, using notes to build it in before the
+	// strings are mapped
+	if(options & OPT_DRONE)
+	{
+		if(droneKeys) {				
+			stackTriads(pChordSelection, -1, 36, 16, notes, droneKeys);
+		}
+		else {
+			// for the drone chord we only play the triad (not stacked)
+			stackTriads(pChordSelection, 1, (droneOctave * 12), 16, notes, 0);
+		}
+		noteSetFromNotes(drone, notes);
+	}
+	else
+	{
+		memset(drone, 0, sizeof(NOTESET));
+	}
+
+	// Each of these fills all 16 strings, with NO_NOTE where
+	// there is nothing to play.
+	// Are we in guitar mode?
+	if(options & OPT_GUITAR)
+	{
+		// build the guitar chord, using stacked triads
+		// as a fallback if there is no chord mapping
+		if(!guitarChord(pChordSelection, 12, notes))
+			stackTriads(pChordSelection, -1, 60, 6, notes, 0);
+			
+		// double up the guitar chords
+		if(options & OPT_GUITAR2)
+		{
+			for(i=0;i<6;++i)
+				if(notes[i] != NO_NOTE)
+					notes[10+i] = 12+notes[i];
+		}
+	}
+	// should we have a chromatic scale mapped to the strings?
+	else if(options & OPT_CHROMATIC)
+	{
+		makeScale(pChordSelection->rootNote, 48, SCALE_CHROMATIC, notes);
+	}
+	// diatonic major or minor
+	else if(options & OPT_DIATONIC)
+	{
+		if((pChordSelection->chordType == CHORD_MIN)||(pChordSelection->chordType == CHORD_MIN7))
+			makeScale(pChordSelection->rootNote, 48, SCALE_MINOR, notes);
+		else
+			makeScale(pChordSelection->rootNote, 48, SCALE_MAJOR, notes);
+	}
+	// pentatonic 
+	else if(options & OPT_PENTATONIC)
+	{
+		makeScale(pChordSelection->rootNote, 48, SCALE_PENTATONIC, notes);
+	}
+	// scale from the bank
+	else if(scaleBankMask)
+	{
+		makeScale(pChordSelection->rootNote, 48, scaleBankMask, notes);
+	}
+	else	
+	{
+		// stack triads
+		stackTriads(pChordSelection, -1, 36, 16, notes, 0);
+	}
 }
 
 ////////////////////////////////////////////////////////////
 //
-// MAKE A SCALE BY MASKING NOTES
+// LOOK UP A CHORD IN THE CACHE, CALCULATING IT IF IT IS NOT
+// THERE. The cache is emptied when anything that affects 
+// the notes of a chord has changed since it was filled
 //
 ////////////////////////////////////////////////////////////
-byte makeScale(int root, byte transpose, unsigned long mask, byte *chord)
+CHORD_CACHE_ENTRY *lookupChord(CHORD_SELECTION *pChordSelection)
 {
-	memset(chord,NO_NOTE,16);
-	unsigned long b = 0;
-	while(root < transpose + 16)
+	byte i;
+	CHORD_CACHE_ENTRY *entry = NULL;
+	CHORD_CACHE_ENTRY *p;
+
+	if(chordCacheOptions != options || 
+		chordCacheScale != scaleBankMask ||
+		chordCacheDroneOctave != droneOctave || 
+		chordCacheDroneKeys != droneKeys)
+	{
+		for(i=0;i<CHORD_CACHE_SIZE;++i)
+			chordCache[i].chord.chordType = CHORD_NONE;
+		chordCacheOptions = options;
+		chordCacheScale = scaleBankMask;
+		chordCacheDroneOctave = droneOctave;
+		chordCacheDroneKeys = droneKeys;
+	}
+
+	// look for the chord, or else the least recently used entry
+	for(i=0;i<CHORD_CACHE_SIZE;++i)
 	{
-			//       210987654321
-		if(!b) b = 0b100000000000;		
-		if(mask & b)
+		p = &chordCache[i];
+		if(p->chord.chordType != CHORD_NONE && 0 == memcmp(&p->chord, pChordSelection, sizeof(CHORD_SELECTION)))
 		{
-			if(root >= transpose)
-				chord[root - transpose] = root;
+			entry = p;
+			break;
 		}
-		++root;
-		b>>=1;
-	}	
+		if(!entry || p->age > entry->age)
+			entry = p;
+	}
+	
+	if(i < CHORD_CACHE_SIZE)
+	{
+		if(chordCacheHits != 0xffff)
+			++chordCacheHits;
+	}
+	else
+	{
+		if(chordCacheMisses != 0xffff)
+			++chordCacheMisses;
+		entry->chord = *pChordSelection;
+		calculateChord(pChordSelection, entry->notes, &entry->drone);
+	}
+
+	// this entry is now the most recently used
+	for(i=0;i<CHORD_CACHE_SIZE;++i)
+		if(chordCache[i].age < entry->age)
+			++chordCache[i].age;
+	entry->age = 0;
+	return entry;
 }
 
 ////////////////////////////////////////////////////////////
 //
-// START PLAYING THE NOTES OF THE NEW CHORD
+// EVENT SCHEDULER
 //
 ////////////////////////////////////////////////////////////
-void playChordNotes(byte *oldNotes, byte *newNotes, byte channel, byte velocity, byte sustainCommon)
+void initEvents()
 {
-	int i,j;
-	
-	// Start by silencing old notes which are not in the new chord
-	for(i=0;i<16;++i)
-	{		
-		if(NO_NOTE != oldNotes[i])
-		{
-			if(sustainCommon)
-			{
-				for(j=0;j<16;++j)
-				{
-					if(oldNotes[i] == newNotes[j])
-						break;
-				}
-				if(j==16)
-				{
-					stopNote(channel, oldNotes[i]);
-					oldNotes[i] = NO_NOTE;
-				}
-			}
-			else
-			{
-				stopNote(channel, oldNotes[i]);
-				oldNotes[i] = NO_NOTE;
-			}
-		}	
+	byte i;
+	for(i=0; i<EVENT_SLOTS; ++i)
+		eventWheel[i] = EVENT_NONE;
+	for(i=0; i<EVENT_POOL; ++i)
+		events[i].next = i + 1;
+	events[EVENT_POOL-1].next = EVENT_NONE;
+	eventFree = 0;
+	eventTick = sysTicks;
+}
+
+// Post an event to run delay ticks (1 to 255) after the tick
+// being run, which is now unless serviceEvents is catching up,
+// so that a step posted by a late event is not late as well.
+// Returns 0 if the pool is full
+byte postEvent(byte delay, byte status, byte data1, byte data2)
+{
+	byte i = eventFree;
+	if(i == EVENT_NONE)
+	{
+		if(eventOverflows != 0xff)
+			++eventOverflows;
+		return 0;
 	}
-	
-	// Now play notes which are not already playing
-	if(velocity)
+	EVENT *e = &events[i];
+	eventFree = e->next;
+
+	byte when = eventTick + delay;
+	if(!delay)
+		++when;
+	e->when = when;
+	e->status = status;
+	e->data1 = data1;
+	e->data2 = data2;
+	e->next = eventWheel[when & EVENT_SLOT_MASK];
+	eventWheel[when & EVENT_SLOT_MASK] = i;
+	return 1;
+}
+
+////////////////////////////////////////////////////////////
+//
+// ARPEGGIATOR STEP
+// Play the note on the next string that has one, and post its
+// note off and the next step
+//
+////////////////////////////////////////////////////////////
+void arpStep()
+{
+	byte rate = (settings & SETTING_ARP) >> SETTING_ARP_SHIFT;
+	byte i, note = NO_NOTE;
+	arpRunning = 0;
+	if(!rate || CHORD_NONE == lastChordSelection.chordType)
+		return;
+	for(i=0; i<16 && note == NO_NOTE; ++i)
 	{
-		for(i=0;i<16;++i)
-		{		
-			if(NO_NOTE != newNotes[i])
+		arpString = (arpString + 1) & 0x0f;
+		note = playStrings.notes[arpString];
+	}
+	byte step = arpSteps[rate - 1];
+	if(note != NO_NOTE && postEvent(step >> 1, 0x90 | playChannel, note, 0))
+		startNote(playChannel, note, playVelocity);
+	arpRunning = postEvent(step, EVENT_ARP, 0, 0);
+}
+
+// Set the rate from a string, 0 for off
+void setArpRate(byte rate)
+{
+	settings &= ~SETTING_ARP;
+	settings |= (unsigned int)rate << SETTING_ARP_SHIFT;
+	journalDirty = 1;
+	ledQueueBlink(1, 10, rate? 2 : 1);
+	if(!arpRunning)
+	{
+		arpString = 15;
+		arpStep();
+	}
+}
+
+////////////////////////////////////////////////////////////
+//
+// RUN THE EVENTS THAT ARE DUE
+// Called from pollIO, which runs every tick since the last
+// call, so events that fall due while it is busy are late but
+// still go in order. An event is freed before it is run so
+// that it can post another
+//
+////////////////////////////////////////////////////////////
+void serviceEvents()
+{
+	while(eventTick != sysTicks)
+	{
+		++eventTick;
+		byte *link = &eventWheel[eventTick & EVENT_SLOT_MASK];
+		byte i;
+		while((i = *link) != EVENT_NONE)
+		{
+			EVENT *e = &events[i];
+			if(e->when != eventTick)
 			{
-				for(j=0;j<16;++j)
-				{
-					if(oldNotes[j] == newNotes[i])
-						break;
-				}
-				if(j==16)
-				{
-					startNote(channel, newNotes[i], velocity);
-				}
+				link = &e->next;
+				continue;
 			}
+			*link = e->next;
+			e->next = eventFree;
+			eventFree = i;
+			if(e->status == EVENT_ARP)
+				arpStep();
+			else if((e->status & 0xf0) == 0x90)
+				queueNote(TXQ_STRING, &playSounding, e->status & 0x0f, e->data1, e->data2);
+			else
+				queueMessage(TXQ_OTHER, e->status, e->data1, e->data2);
 		}
 	}
-
-	// remember the notes
-	memcpy(oldNotes, newNotes, 16);
 }
 
 ////////////////////////////////////////////////////////////
 //
-// RELEASE THE NOTES OF A CHORD
+// PRESETS
+//
+// A preset holds the patch, settings, channels, drone octave
+// and keys and the play velocity. A record is read in one
+// pass and is only used if its format and CRC are right, so
+// one that is empty, from other firmware or only partly
+// written is turned down and nothing changes. Storing goes
+// through serviceEeprom like the journal, so neither holds
+// up the scan, and a store is turned down while the last one
+// is still waiting for it. Slot 0 to PRESET_SLOTS-1
 //
 ////////////////////////////////////////////////////////////
-void releaseChordNotes(byte *oldNotes, byte channel, byte sustain)
+void recallPreset(byte slot)
 {
-	int i;
-
-	// override allowed by sustain option
-	if(sustain)
+	byte record[PRESET_RECORD_SIZE];
+	byte i;
+	if(slot >= PRESET_SLOTS)
+	{
+		ledQueueBlink(20, 10, 4);
 		return;
-		
-	// Silence notes 
-	for(i=0;i<16;++i)
-	{		
-		if(NO_NOTE != oldNotes[i])
-		{
-			stopNote(channel, oldNotes[i]);
-			oldNotes[i] = NO_NOTE;
-		}	
 	}
+	byte addr = EEPROM_ADDR_PRESETS + slot * PRESET_RECORD_SIZE;
+	for(i=0; i<PRESET_RECORD_SIZE; ++i)
+		record[i] = eepromRead(addr + i);
+	if(record[PRESET_FORMAT] != PRESET_FORMAT_VERSION ||
+		crc8(record, PRESET_CRC) != record[PRESET_CRC] ||
+		record[PRESET_DRONE_OCTAVE] > 8)
+	{
+		ledQueueBlink(20, 10, 4);	// nothing there
+		return;
+	}
+
+	setChannels(record[PRESET_CHANNELS] >> 4, record[PRESET_CHANNELS] & 0x0f);
+	options = (unsigned int)record[PRESET_OPTIONS_HIGH]<<8 | record[PRESET_OPTIONS_LOW];
+	userOptions = options;
+	settings = (unsigned int)record[PRESET_SETTINGS_HIGH]<<8 | record[PRESET_SETTINGS_LOW];
+	droneOctave = record[PRESET_DRONE_OCTAVE];
+	droneKeys = (unsigned int)record[PRESET_DRONE_KEYS_HIGH]<<8 | record[PRESET_DRONE_KEYS_LOW];
+	playVelocity = record[PRESET_VELOCITY];
+	strumLevel = playVelocity;
+	loadScale();
+	journalDirty = 1;
+	ledQueueBlink(1, 10, 3);
+	if(!arpRunning)
+	{
+		arpString = 15;
+		arpStep();
+	}
+}
 
+void storePreset(byte slot)
+{
+	if(slot >= PRESET_SLOTS)
+	{
+		ledQueueBlink(20, 10, 4);
+		return;
+	}
+	if(presetStore != NO_SELECTION)
+	{
+		// the last one has not been written yet
+		ledQueueBlink(20, 10, 4);
+		return;
+	}
+	presetStore = slot;
+	userOptions = options;
+	journalDirty = 1;
+	ledQueueBlink(200, 0, 1);	// 2 seconds
 }
 
 ////////////////////////////////////////////////////////////
 //
-// CALCULATE NOTES FOR A CHORD SHAPE, MAP THEM TO THE STRINGS
-// AND START PLAYING DRONE IF APPROPRIATE
+// CHANGE TO A NEW CHORD (OR NO CHORD) AND START PLAYING 
+// DRONE IF APPROPRIATE
 //
 ////////////////////////////////////////////////////////////
 void changeToChord(CHORD_SELECTION *pChordSelection)
 {	
-	
-	int i,j;
-	byte chord[16];
-	byte chordLen;
-	byte notes[16];
+	CHORD_CACHE_ENTRY *entry;
+	NOTESET noteSet;
 		
 	// is the new chord a "no chord"
 	if(CHORD_NONE == pChordSelection->chordType)
 	{
-		releaseChordNotes(playNotes, playChannel, !!(options & OPT_SUSTAIN));
-		releaseChordNotes(droneNotes, droneChannel, !!(options & OPT_SUSTAINDRONE));		
+		if(!(options & OPT_SUSTAIN))
+			memset(playStrings.notes, NO_NOTE, 16);
+		releaseChordNotes(&playStrings.chord, &playSounding, playChannel, !!(options & OPT_SUSTAIN));
+		releaseChordNotes(&droneNotes, &droneSounding, droneChannel, !!(options & OPT_SUSTAINDRONE));		
 	}
 	else 	
 	{			
-		// are we in guitar mode?
-		if(options & OPT_GUITAR)
-		{
-			// build the guitar chord, using stacked triads
-			// as a fallback if there is no chord mapping
-			chordLen = guitarChord(pChordSelection, 12, chord);
-			if(!chordLen)
-			{
-				stackTriads(pChordSelection, -1, 60, 6, chord, 0);
-				chordLen = 6;
-			}
-				
-			// double up the guitar chords
-			if(options & OPT_GUITAR2)
-			{
-				for(i=0;i<6;++i)
-					if(chord[i] != NO_NOTE)
-						chord[10+i] = 12+chord[i];
-				chordLen = 16;
-			}
-		}
-		// should we have a chromatic scale mapped to the strings?
-		else if(options & OPT_CHROMATIC)
-		{
-			makeScale(pChordSelection->rootNote, 48, 0b111111111111, chord);
-			chordLen=16;
-		}
-		// diatonic major or minor
-		else if(options & OPT_DIATONIC)
-		{
-			if((pChordSelection->chordType == CHORD_MIN)||(pChordSelection->chordType == CHORD_MIN7))
-				makeScale(pChordSelection->rootNote, 48, 0b101101011010, chord);
-			else
-				makeScale(pChordSelection->rootNote, 48, 0b101011010101, chord);
-			chordLen=16;
-		}
-		// pentatonic 
-		else if(options & OPT_PENTATONIC)
-		{
-			makeScale(pChordSelection->rootNote, 48, 0b101010010100, chord);
-			chordLen=16;
-		}
-		else	
-		{
-			// stack triads
-			stackTriads(pChordSelection, -1, 36, 16, chord, 0);
-			chordLen = 16;
-		}
-	
-		// copy chord to notes and pad with null notes
-		memset(notes, NO_NOTE, 16);
-		memcpy(notes, chord, chordLen);
+		entry = lookupChord(pChordSelection);
 		
 		// damp notes which are not a part of the new chord
-		playChordNotes(playNotes, notes, playChannel, 0, !!(options & OPT_SUSTAINCOMMON));
+		noteSetFromNotes(&noteSet, entry->notes);
+		playChordNotes(&playStrings.chord, &noteSet, &playSounding, playChannel, 0, !!(options & OPT_SUSTAINCOMMON));
+		memcpy(playStrings.notes, entry->notes, 16);
 
 		// deal with drone
 		if(options & OPT_DRONE)
-		{
-			if(droneKeys) {				
-				stackTriads(pChordSelection, -1, 36, 16, notes, droneKeys);
-			}
-			else {
-				// for the drone chord we only play the triad (not stacked)
-				stackTriads(pChordSelection, 1, (droneOctave * 12), 16, notes, 0);
-			}
-			playChordNotes(droneNotes, notes, droneChannel, droneVelocity, !!(options & OPT_SUSTAINDRONECOMMON));
-		}
+			playChordNotes(&droneNotes, &entry->drone, &droneSounding, droneChannel, droneVelocity, !!(options & OPT_SUSTAINDRONECOMMON));
 	}
 	
 	// Store the chord, so we can recognise when it changes
 	lastChordSelection = *pChordSelection;
+
+	// start the arpeggiator from the lowest string, unless it
+	// is already running (in which case it follows the change)
+	if(!arpRunning)
+	{
+		arpString = 15;
+		arpStep();
+	}
 	
 }
 
+////////////////////////////////////////////////////////////
+//
+// STRUM SPEED TO VELOCITY
+// Each string that starts a note is timed against the one
+// before. Moving up to 4 strings along (a fast strum can
+// cross more than one string per scan) gives a velocity
+// from the selected curve, based on the log of the time per
+// string. The first string of a strum gets the velocity
+// that the last strum ended with
+//
+////////////////////////////////////////////////////////////
+byte strumBucket(word dt)
+{
+	// half octave steps from 512us
+	byte bucket = 1;
+	dt >>= 6;
+	if(dt < 2)
+		return 0;
+	while(dt >= 4)
+	{
+		bucket += 2;
+		dt >>= 1;
+	}
+	bucket += (dt & 1);
+	return (bucket > 15)? 15 : bucket;
+}
+
+byte strumVelocity(byte string, word t)
+{
+	byte curve = (settings & SETTING_VELOCITY_CURVE) >> SETTING_VELOCITY_CURVE_SHIFT;
+	byte distance, bucket;
+	if(!curve)
+		return playVelocity;
+	distance = (string > strumString)? string - strumString : strumString - string;
+	if(distance && distance <= 4)
+	{
+		// take off 2*log2(distance) half octaves for the time per string
+		bucket = strumBucket(t - strumTime);
+		distance = (distance == 4)? 4 : (distance - 1) + (distance >> 1);
+		bucket = (bucket > distance)? bucket - distance : 0;
+		strumLevel = velocityCurves[((curve-1)<<4) + bucket];
+	}
+	strumString = string;
+	strumTime = t;
+	strumTick = sysTicks;
+	return strumLevel;
+}
+
+// Called from pollIO. Both timers wrap in about 262ms so a
+// pause in the strum has to be noticed while it happens
+void serviceStrum()
+{
+	if(strumString != NO_SELECTION && (byte)(sysTicks - strumTick) >= STRUM_TIMEOUT_MS)
+		strumString = NO_SELECTION;
+}
+
+////////////////////////////////////////////////////////////
+//
+// SELECT THE NEXT VELOCITY CURVE
+// Flashes once for off, or 2-4 times for the curve number
+//
+////////////////////////////////////////////////////////////
+void nextVelocityCurve()
+{
+	byte curve = ((settings & SETTING_VELOCITY_CURVE) >> SETTING_VELOCITY_CURVE_SHIFT) + 1;
+	settings &= ~SETTING_VELOCITY_CURVE;
+	settings |= (curve << SETTING_VELOCITY_CURVE_SHIFT) & SETTING_VELOCITY_CURVE;
+	journalDirty = 1;
+	ledQueueBlink(1, 10, 1 + ((settings & SETTING_VELOCITY_CURVE) >> SETTING_VELOCITY_CURVE_SHIFT));
+}
+
 ////////////////////////////////////////////////////////////
 //
 // POLL INPUT AND MANAGE THE SENDING OF MIDI INFO
 //
 ////////////////////////////////////////////////////////////
+// Root notes for the columns in the circle of fifths layout
+// (C# G# D# A# F C G D A E B F#)
+rom char *circleOf5thsRoots = 
+	"\x01\x08\x03\x0a\x05\x00\x07\x02\x09\x04\x0b\x06\xff\xff\xff\xff";
+
 byte mapRootNote(byte col)
 {
 	if(!(settings & SETTING_CIRCLEOF5THS))
 		return col;
-	switch(col)
+	return circleOf5thsRoots[col];
+}
+
+////////////////////////////////////////////////////////////
+//
+// DEBOUNCE THE CHORD BUTTONS FROM A KEY SCAN
+//
+////////////////////////////////////////////////////////////
+void debounceKeys(SCAN_FRAME *frame)
+{
+	byte row;
+	for(row=0; row<4; ++row)
+	{
+		// count the scans that each button has disagreed with its 
+		// state, starting again whenever it agrees
+		unsigned int sample = (row == KEY_ROW_MODE)? frame->mode : frame->keys[row];
+		unsigned int delta = sample ^ keyState[row];
+		unsigned int count0 = keyCount0[row];
+		keyCount1[row] = (keyCount1[row] ^ count0) & delta;
+		keyCount0[row] = ~count0 & delta;
+
+		// buttons which have now done it KEY_DEBOUNCE times change
+		unsigned int change = delta & 
+			~(keyCount0[row] ^ KEY_DEBOUNCE_PLANE(1)) & 
+			~(keyCount1[row] ^ KEY_DEBOUNCE_PLANE(2));
+		keyState[row] ^= change;
+		keyCount0[row] &= ~change;
+		keyCount1[row] &= ~change;
+	}
+}
+
+////////////////////////////////////////////////////////////
+//
+// DECODE THE CHORD SELECTION FROM THE DEBOUNCED BUTTONS
+// The first column with a button held is the root, and the
+// rows held in it are the bits of the chord type. The next
+// column with a button held gives the extension. Returns the
+// root column
+//
+////////////////////////////////////////////////////////////
+
+// Extension for the rows held in a column (bit 0 for row 1).
+// Two or three rows held give the extensions that have no 
+// guitar voicing
+rom char *keyExtensions = 
+	"\x00\x01\x02\x04\x03\x05\x06\x07";	// none, SUS_4, ADD_6, SUS_2, ADD_9..
+
+// Rows held in the column with bit mask col
+byte keyRows(unsigned int col)
+{
+	byte rows = 0;
+	if(keyState[0] & col)
+		rows |= 0b001;
+	if(keyState[1] & col)
+		rows |= 0b010;
+	if(keyState[2] & col)
+		rows |= 0b100;
+	return rows;
+}
+
+byte decodeChord(CHORD_SELECTION *pChordSelection)
+{
+	unsigned int held = keyState[0] | keyState[1] | keyState[2];
+	unsigned int col = 1;
+	byte root = 0;
+
+	pChordSelection->chordType = CHORD_NONE;
+	pChordSelection->rootNote = NO_NOTE;
+	pChordSelection->extension = ADD_NONE;
+	if(!held)
+		return NO_SELECTION;
+	while(!(held & col))
+	{
+		col <<= 1;
+		++root;
+	}
+	pChordSelection->rootNote = mapRootNote(root);
+
+	// This logic allows more buttons to be registered without clearing
+	// old buttons if the root note is unchanged. This is to ensure that
+	// new chord shapes are not applied as the user releases the buttons
+	if(root == lastRootNoteColumn)
+		pChordSelection->chordType = lastChordSelection.chordType;
+	pChordSelection->chordType |= keyRows(col);
+
+	// Check for chord extension, which is where an additional
+	// button is held in a column to the right of the root column
+	held &= ~col;
+	if((options & OPT_ADDNOTES) && held)
 	{
-		case 0: return ROOT_CSHARP;
-		case 1: return ROOT_GSHARP;
-		case 2: return ROOT_DSHARP;
-		case 3: return ROOT_ASHARP;
-		case 4: return ROOT_F;
-		case 5: return ROOT_C;
-		case 6: return ROOT_G;
-		case 7: return ROOT_D;
-		case 8: return ROOT_A;		
-		case 9: return ROOT_E;
-		case 10: return ROOT_B;
-		case 11: return ROOT_FSHARP;
+		while(!(held & col))
+			col <<= 1;
+		pChordSelection->extension = keyExtensions[keyRows(col)];
 	}
-	return NO_NOTE;
+	return root;
 }
 
 ////////////////////////////////////////////////////////////
@@ -1022,136 +3139,174 @@ byte mapRootNote(byte col)
 ////////////////////////////////////////////////////////////
 void pollIO()
 {
-	// clock a single bit into the shift register
-	P_CLK = 0;
-	P_DS = 1;	
-	P_CLK = 1;
-	P_DS = 0;	
-
+	serviceLed();
+	serviceEeprom();
+	serviceStrum();
+	serviceEvents();
+	serviceStats();
+	servicePanic();
+
+	// wait for the scan interrupt to complete a frame
+	if(!scanFrameReady)
+	{
+		HAL_IDLE();
+		return;
+	}
+	SCAN_FRAME *frame = &scanFrames[scanWrite^1];
+#ifdef PERF_STATS
+	word pollStart;
+	READ_TIMER1(pollStart);
+#endif
+
+	// frames which did not scan the chord buttons get the last 
+	// ones that were seen
+	if(frame->keysScanned)
+		memcpy(scanLastKeys, frame->keys, sizeof(scanLastKeys));
+	else
+		memcpy(frame->keys, scanLastKeys, sizeof(scanLastKeys));
+#ifdef PERF_STATS
+	histAdd(HIST_SCAN_PERIOD, frame->stamp - histLastStamp);
+	histLastStamp = frame->stamp;
+	histAdd(HIST_TX_DEPTH, txPending());
+	if(latencyState == LATENCY_SENT)
+	{
+		histAdd(HIST_LATENCY, latencyEnd - latencyStart);
+		latencyState = LATENCY_IDLE;
+	}
+#endif
+#ifdef SCAN_TRACE
+	traceFrame(frame);
+#endif
 	
-	rootNoteColumn = NO_SELECTION;
 	CHORD_SELECTION chordSelection = { CHORD_NONE,  NO_NOTE, ADD_NONE };
-	unsigned long b = 1;
+	unsigned int b = 1;
+	unsigned int col = 1;
 	byte stringCount = 0;
+	unsigned int offset = 0;
+	word eventTime;
+	
+	// debounce and decode the chord buttons, if they were 
+	// sampled in this frame
+	if(frame->keysScanned)
+	{
+		debounceKeys(frame);
+		rootNoteColumn = decodeChord(&chordSelection);
+	}
 	
-	// scan for each string
+	// scan for each string, which are sampled at slightly different times
+	byte *period = frame->keysScanned? scanPeriod : stringSettle;
 	for(int i=0;i<16;++i)
 	{			
 		int whichString = (!!(settings & SETTING_REVERSESTRUM))? (15-i) : i;
-		
-		// clock pulse to shift the bit (the first bit does not appear until the
-		// second clock pulse, since we tied shift and store clock lines together)
-		P_CLK = 0;				
-		P_CLK = 1;
 
-		// Allow inputs to settle
-		delay_ms(1);
-		
-		// did we get a signal back on any of the  keyboard scan rows?
-		if(P_KEYS1 || P_KEYS2 || P_KEYS3)
-		{
-			// Is this the first column with a button held 
-			if(rootNoteColumn == NO_SELECTION)
-			{
-				// This logic allows more buttons to be registered without clearing
-				// old buttons if the root note is unchanged. This is to ensure that
-				// new chord shapes are not applied as the user releases the buttons
-				rootNoteColumn = i;					
-				chordSelection.rootNote = mapRootNote(i);
-				if(i == lastRootNoteColumn)
-					chordSelection.chordType = lastChordSelection.chordType;
-				chordSelection.chordType |= (P_KEYS1? CHORD_MAJ:CHORD_NONE)|(P_KEYS2? CHORD_MIN:CHORD_NONE)|(P_KEYS3? CHORD_DOM7:CHORD_NONE);					
-			}	
-			// Check for chord extension, which is where an additional
-			// button is held in a column to the right of the root column
-			else if((options & OPT_ADDNOTES) && (chordSelection.extension == ADD_NONE))
-			{
-				if(P_KEYS1)
-					chordSelection.extension = SUS_4;
-				else if(P_KEYS2)
-					chordSelection.extension = ADD_6;
-				else if(P_KEYS3)
-					chordSelection.extension = ADD_9;
-			}
-		}
+		// when this column was sampled, in timer 1 counts
+		if(i)
+			offset += period[i] + 1;
+		eventTime = frame->stamp + (offset >> 1);
 
+		byte stylus = !!(frame->stylus & col);
+		col <<= 1;
+		
 		// if MODE is pressed the stylus is used to change the MIDI velocity
-		if(!P_MODE)
+		if(keyState[KEY_ROW_MODE])
 		{
-			if(P_STYLUS) {
+			if(stylus) {
 				switch(shiftMode) {
 					case SHIFTMODE_PLAYCHANNEL:
 						setPlayChannel(whichString);
 						shiftMode = SHIFTMODE_NONE;
-						P_LED = 0;
 						break;
 					case SHIFTMODE_DRONECHANNEL:
 						setDroneChannel(whichString);
 						shiftMode = SHIFTMODE_NONE;
-						P_LED = 0;
 						break;
 					case SHIFTMODE_DRONEOCTAVE:
 						setDroneOctave(whichString);
 						shiftMode = SHIFTMODE_NONE;
-						P_LED = 0;
 						break;
 					case SHIFTMODE_DRONEKEYS:
 						droneKeys |= (((unsigned int)1)<<whichString);						
 						break;
+					case SHIFTMODE_SCALE:
+						selectScale(whichString);
+						shiftMode = SHIFTMODE_NONE;
+						break;
+					case SHIFTMODE_ARP:
+						setArpRate(whichString);
+						shiftMode = SHIFTMODE_NONE;
+						break;
+					case SHIFTMODE_RECALL:
+						recallPreset(whichString);
+						shiftMode = SHIFTMODE_NONE;
+						break;
+					case SHIFTMODE_STORE:
+						storePreset(whichString);
+						shiftMode = SHIFTMODE_NONE;
+						break;
 					default:
 						playVelocity = 0x0f | (whichString<<4);
+						strumLevel = playVelocity;
 						break;
 				}
 			}
 			if(shiftMode!=SHIFTMODE_NONE) {
-				P_LED = !!(++ledToggle&0x10);
+				ledIdle(!!(++ledToggle&0x10));
 			}
 		}
 		// otherwise check whether we got a signal back from the stylus (meaning that
 		// it's touching this string)
 		else 
 		{
-			shiftMode = SHIFTMODE_NONE;
-			P_LED = 0;
-			if(P_STYLUS)
+			if(shiftMode != SHIFTMODE_NONE)
+			{
+				shiftMode = SHIFTMODE_NONE;
+				ledIdle(0);
+			}
+			if(stylus)
 			{
 				++stringCount;
 				
 				// string is being touched... was
 				// it being touched before?
-				if(!(strings & b))
+				if(!(playStrings.touched & b))
 				{
 					// remember this string is being touched
-					strings |= b;
+					playStrings.touched |= b;
 					
 					// does it map to a real note?
-					if(playNotes[whichString] != NO_NOTE)
+					if(playStrings.notes[whichString] != NO_NOTE)
 					{
 						// play or damp the note as needed
 						if(options & OPT_PLAYONMAKE)
-							startNote(playChannel, playNotes[whichString],  playVelocity);						
+						{
+							latencyMark(eventTime);
+							startNote(playChannel, playStrings.notes[whichString], strumVelocity(whichString, eventTime));
+						}						
 						else
 						if(options & OPT_STOPONMAKE)
-							stopNote(playChannel, playNotes[whichString]);						
+							stopNote(playChannel, playStrings.notes[whichString]);						
 					}
 				}
 			}
 			// stylus not touching string now, but was it 
 			// touching the string before?
-			else if(strings & b)
+			else if(playStrings.touched & b)
 			{
 				// remember string is not being touched
-				strings &= ~b;
+				playStrings.touched &= ~b;
 				
 				// does it map to a real note?
-				if(playNotes[whichString] != NO_NOTE)
+				if(playStrings.notes[whichString] != NO_NOTE)
 				{
 					// play or damp the note as needed
 					if(options & OPT_PLAYONBREAK)
-						startNote(playChannel, playNotes[whichString],  playVelocity);						
+					{
+						latencyMark(eventTime);
+						startNote(playChannel, playStrings.notes[whichString], strumVelocity(whichString, eventTime));
+					}						
 					else
 					if(options & OPT_STOPONBREAK)
-						stopNote(playChannel, playNotes[whichString]);						
+						stopNote(playChannel, playStrings.notes[whichString]);						
 				}
 			}	
 			
@@ -1161,80 +3316,103 @@ void pollIO()
 	}	
 		
 
-	if(!P_MODE)
-	{		
-		// MODE is pressed, has a chord button been newly pressed?
-		if(rootNoteColumn != lastRootNoteColumn)
-		{				
-			switch(chordSelection.chordType)
-			{
-			case CHORD_MAJ: // ROW 1
-				switch(rootNoteColumn)
+	// act on the chord buttons, if they were scanned
+	if(frame->keysScanned)
+	{
+		if(keyState[KEY_ROW_MODE])
+		{		
+			// MODE is pressed, has a chord button been newly pressed?
+			if(rootNoteColumn != lastRootNoteColumn)
+			{				
+				switch(chordSelection.chordType)
 				{
-				case 0: presetPatch(patch_BasicStrum); break;
-				case 2: presetPatch(patch_GuitarStrum); break;
-				case 4: presetPatch(patch_GuitarSustain); break;
-				case 5: presetPatch(patch_OrganButtons); break;
-				case 7: presetPatch(patch_OrganButtonsAddedNotes); break;
-				case 9: presetPatch(patch_OrganButtonsAddedNotesRetrig); break;
-				case 10: shiftMode = SHIFTMODE_DRONEOCTAVE; break;				
-				case 11: loadUserPatch(); break;
-				}
-				break;
+				case CHORD_MAJ: // ROW 1
+					switch(rootNoteColumn)
+					{
+					case 0: presetPatch(patch_BasicStrum); break;
+					case 1: calibrateSettle(); break;
+					case 2: presetPatch(patch_GuitarStrum); break;
+					case 3: sendStats(); break;
+					case 4: presetPatch(patch_GuitarSustain); break;
+					case 5: presetPatch(patch_OrganButtons); break;
+					case 6: shiftMode = SHIFTMODE_ARP; break;
+					case 7: presetPatch(patch_OrganButtonsAddedNotes); break;
+					case 8: shiftMode = SHIFTMODE_SCALE; break;				
+					case 9: presetPatch(patch_OrganButtonsAddedNotesRetrig); break;
+					case 10: shiftMode = SHIFTMODE_DRONEOCTAVE; break;				
+					case 11: shiftMode = SHIFTMODE_RECALL; break;
+					}
+					break;
 				
-			case CHORD_MIN: // ROW 2
-				switch(rootNoteColumn)
-				{
-				case 0: toggleOption(OPT_PLAYONMAKE); break;
-				case 1: toggleOption(OPT_PLAYONBREAK); break;
-				case 2: toggleOption(OPT_GUITAR); break;
-				case 3: toggleOption(OPT_ADDNOTES); break;
-				case 4: toggleOption(OPT_SUSTAIN); break;
-				case 5: toggleOption(OPT_CHROMATIC); clearOptions(OPT_DIATONIC|OPT_PENTATONIC); break;
-				case 7: toggleOption(OPT_DRONE); break;
-				case 8: toggleOption(OPT_SUSTAINDRONE); break;
-				case 9: shiftMode = SHIFTMODE_PLAYCHANNEL; break;				
-				case 10: toggleSetting(SETTING_REVERSESTRUM); break;
-				case 11: saveUserPatch(); break;
-				}
-				break;	
+				case CHORD_MIN: // ROW 2
+					switch(rootNoteColumn)
+					{
+					case 0: toggleOption(OPT_PLAYONMAKE); break;
+					case 1: toggleOption(OPT_PLAYONBREAK); break;
+					case 2: toggleOption(OPT_GUITAR); break;
+					case 3: toggleOption(OPT_ADDNOTES); break;
+					case 4: toggleOption(OPT_SUSTAIN); break;
+					case 5: toggleOption(OPT_CHROMATIC); clearOptions(OPT_DIATONIC|OPT_PENTATONIC); break;
+					case 6: nextVelocityCurve(); break;
+					case 7: toggleOption(OPT_DRONE); break;
+					case 8: toggleOption(OPT_SUSTAINDRONE); break;
+					case 9: shiftMode = SHIFTMODE_PLAYCHANNEL; break;				
+					case 10: toggleSetting(SETTING_REVERSESTRUM); break;
+					case 11: shiftMode = SHIFTMODE_STORE; break;
+					}
+					break;	
 				
-			case CHORD_DOM7: // ROW3
-				switch(rootNoteColumn)
-				{
-				case 0: toggleOption(OPT_STOPONMAKE); break;
-				case 1: toggleOption(OPT_STOPONBREAK); break;
-				case 2: toggleOption(OPT_GUITAR2); break;
-				case 3: toggleOption(OPT_GUITARBASSNOTES); break;
-				case 4: toggleOption(OPT_SUSTAINCOMMON); break;
-				case 5: toggleOption(OPT_DIATONIC); clearOptions(OPT_CHROMATIC|OPT_PENTATONIC); break;
-				case 6: toggleOption(OPT_PENTATONIC); clearOptions(OPT_DIATONIC|OPT_CHROMATIC); break;
-				case 7: droneKeys = 0; shiftMode = SHIFTMODE_DRONEKEYS; break;				
-				case 8: toggleOption(OPT_SUSTAINDRONECOMMON); break;
-				case 9: shiftMode = SHIFTMODE_DRONECHANNEL; break;				
-				case 10: toggleSetting(SETTING_CIRCLEOF5THS); break;
-				case 11:
-					// MIDI Panic
-					stopAllNotes(playChannel);
-					if(options & OPT_DRONE)
-						stopAllNotes(droneChannel);
-					break;
-				}
-				break;		
-			}	
+				case CHORD_DOM7: // ROW3
+					switch(rootNoteColumn)
+					{
+					case 0: toggleOption(OPT_STOPONMAKE); break;
+					case 1: toggleOption(OPT_STOPONBREAK); break;
+					case 2: toggleOption(OPT_GUITAR2); break;
+					case 3: toggleOption(OPT_GUITARBASSNOTES); break;
+					case 4: toggleOption(OPT_SUSTAINCOMMON); break;
+					case 5: toggleOption(OPT_DIATONIC); clearOptions(OPT_CHROMATIC|OPT_PENTATONIC); break;
+					case 6: toggleOption(OPT_PENTATONIC); clearOptions(OPT_DIATONIC|OPT_CHROMATIC); break;
+					case 7: droneKeys = 0; shiftMode = SHIFTMODE_DRONEKEYS; break;				
+					case 8: toggleOption(OPT_SUSTAINDRONECOMMON); break;
+					case 9: shiftMode = SHIFTMODE_DRONECHANNEL; break;				
+					case 10: toggleSetting(SETTING_CIRCLEOF5THS); break;
+					case 11: midiPanic(); break;
+					}
+					break;		
+				}	
+			}
+		}
+		else
+		{
+			// has the chord changed? note that if the stylus is bridging 2 strings we will not change
+			// the chord selection. This is because this situation can confuse the keyboard matrix
+			// causing unwanted chord changed
+			if((stringCount < 2) && 0 != memcmp(&chordSelection, &lastChordSelection, sizeof(CHORD_SELECTION)))
+			{
+#ifdef PERF_STATS
+				word changeStart, changeEnd;
+				READ_TIMER1(changeStart);
+				changeToChord(&chordSelection);	
+				READ_TIMER1(changeEnd);
+				histAdd(HIST_CHORD_CHANGE, changeEnd - changeStart);
+#else
+				changeToChord(&chordSelection);	
+#endif
+			}
 		}
-	}
-	else
-	{
-		// has the chord changed? note that if the stylus is bridging 2 strings we will not change
-		// the chord selection. This is because this situation can confuse the keyboard matrix
-		// causing unwanted chord changed
-		if((stringCount < 2) && 0 != memcmp(&chordSelection, &lastChordSelection, sizeof(CHORD_SELECTION)))
-			changeToChord(&chordSelection);	
-	}
 	
-	// remember the root note for this keyboard scan
-	lastRootNoteColumn = rootNoteColumn;
+		// remember the root note for this keyboard scan
+		lastRootNoteColumn = rootNoteColumn;
+	}
+
+	// let the interrupt have the frame back
+	scanFrameReady = 0;
+
+#ifdef PERF_STATS
+	word pollEnd;
+	READ_TIMER1(pollEnd);
+	histAdd(HIST_POLL_TIME, pollEnd - pollStart);
+#endif
 }
 
 ////////////////////////////////////////////////////////////
@@ -1244,65 +3422,88 @@ void pollIO()
 ////////////////////////////////////////////////////////////
 void showVersion()
 {
-	int i;
-	for(i=0;i<VERSION_NUMBER;++i)
-	{
-		P_LED = 1;
-		delay_ms(200);
-		delay_ms(200);
-		P_LED = 0;
-		delay_ms(200);
-	}
+	ledQueueBlink(40, 20, VERSION_NUMBER);
 }
 
 ////////////////////////////////////////////////////////////
 //
-// ENTRY POINT
+// POWER ON INITIALISATION
 //
 ////////////////////////////////////////////////////////////
-void main()
+void startup()
 { 
-	// osc control / 8MHz / internal
-	osccon = 0b01110010;
+	byte i;
 
-	// weak pull up on A0 and C5
-	wpua = 0b00000001;
-	wpuc = 0b00100000;
-	option_reg.7 = 0;
-	
-	
 	// configure io
-			//76543210
-	trisa = 0b00110000;              	
-    trisc = 0b00101010;              
-    
-	ansela = 0b00000000;
-	anselc = 0b00000000;
+	init_ports();
 
-	if(!P_MODE)
+	if(!HAL_MODE)
 	{
 		showVersion();
 	}
 	else
 	{
-		P_LED = 1;
-		delay_ms(100);
-		P_LED = 0;
+		ledQueueBlink(10, 0, 1);
 	}
 	
-	// initialise MIDI comms
+	// lay out the MIDI transmit queues
+	txBase[TXQ_THRU] = 0;
+	txBase[TXQ_STRING] = TXQ_THRU_SIZE;
+	txBase[TXQ_DRONE] = TXQ_THRU_SIZE + TXQ_STRING_SIZE;
+	txBase[TXQ_OTHER] = TXQ_THRU_SIZE + TXQ_STRING_SIZE + TXQ_DRONE_SIZE;
+	txMask[TXQ_THRU] = TXQ_THRU_SIZE - 1;
+	txMask[TXQ_STRING] = TXQ_STRING_SIZE - 1;
+	txMask[TXQ_DRONE] = TXQ_DRONE_SIZE - 1;
+	txMask[TXQ_OTHER] = TXQ_OTHER_SIZE - 1;
+
+	// initialise MIDI comms and the system tick
 	init_usart();
+	init_timer0();
+	init_timer1();
+#ifdef SCAN_SPI
+	init_spi();
+#endif
 
 	// initialise the notes array
-	memset(playNotes,NO_NOTE,sizeof(playNotes));
-	memset(droneNotes,NO_NOTE,sizeof(droneNotes));
+	memset(&playStrings,0,sizeof(playStrings));
+	memset(playStrings.notes,NO_NOTE,sizeof(playStrings.notes));
+	memset(&droneNotes,0,sizeof(droneNotes));
+	memset(&playSounding,0,sizeof(playSounding));
+	memset(&droneSounding,0,sizeof(droneSounding));
+	for(i=0;i<CHORD_CACHE_SIZE;++i)
+	{
+		chordCache[i].chord.chordType = CHORD_NONE;
+		chordCache[i].age = i;
+	}
 
 	// load the user patch and device settings
-	loadSettingsFromEEPROM();	
+	journalLoad();
+	options = userOptions;
+	initScaleBank();
+	loadScale();
+	initEvents();
+
+	// start scanning the strings
+	loadSettleTimes();
+	initScan();
+}
+
+#ifndef STRUM_HOST
+////////////////////////////////////////////////////////////
+//
+// ENTRY POINT
+// (the host build drives startup and pollIO from the
+// simulator instead, see host/strumsim.c)
+//
+////////////////////////////////////////////////////////////
+void main()
+{ 
+	startup();
 	for(;;)
 	{
 		// and now just repeatedly
 		// check for input
 		pollIO();
 	}
-}
\ No newline at end of file
+}
+#endif // STRUM_HOST
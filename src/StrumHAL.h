@@ -0,0 +1,107 @@
+////////////////////////////////////////////////////////////
+//
+// LE STRUM - HARDWARE ABSTRACTION LAYER
+//
+// Every access the firmware makes to a PIC register goes
+// through the macros in this file. For the real target they
+// map straight onto the SourceBoost register bits, so there
+// is no cost. When STRUM_HOST is defined (see host/Makefile)
+// they map onto the deterministic simulator in host/sim.h
+// so the firmware can be run and profiled on a workstation
+//
+////////////////////////////////////////////////////////////
+#ifndef STRUM_HAL_H
+#define STRUM_HAL_H
+
+#ifdef STRUM_HOST
+
+#include "host/sim.h"
+
+#else
+
+// INCLUDE FILES
+#include <system.h>
+#include <memory.h>
+#include <eeprom.h>
+
+// 16 bit unsigned, for timer counts that are expected to wrap
+typedef unsigned int word;
+
+// Define pins. With SCAN_SPI the shift register is clocked by
+// the MSSP, so its clock and data lines must be wired to SCK1 
+// (RC0) and SDO1 (RC2) and the LED moves to RA2
+#ifdef SCAN_SPI
+#define P_LED 			porta.2
+#else
+#define P_CLK 			porta.2
+#define P_DS 			portc.0
+#define P_LED 			portc.2
+#endif
+#define P_STYLUS 		portc.1
+#define P_KEYS1	 		porta.5
+#define P_KEYS2	 		porta.4
+#define P_KEYS3	 		portc.3
+#define P_MODE	 		portc.5
+//portc.4 = TX
+//porta.1 = RX (moved from portc.5 by init_usart)
+
+// Shift register outputs
+#ifndef SCAN_SPI
+#define HAL_CLK(v)		P_CLK = (v)
+#define HAL_DS(v)		P_DS = (v)
+#endif
+#define HAL_LED(v)		P_LED = (v)
+
+// Inputs
+#define HAL_STYLUS		P_STYLUS
+#define HAL_KEYS1		P_KEYS1
+#define HAL_KEYS2		P_KEYS2
+#define HAL_KEYS3		P_KEYS3
+#define HAL_MODE		P_MODE
+
+// USART transmit
+#define HAL_TXREG(c)	txreg = (c)
+#define HAL_TXIF		pir1.4		// TXREG empty
+#define HAL_TXIE_ON		pie1.4
+#define HAL_TXIE(v)		pie1.4 = (v)
+
+// USART receive
+#define HAL_RCREG		rcreg
+#define HAL_RCIF		pir1.5		// RCREG has a byte
+#define HAL_FERR		rcsta.2		// framing error on the byte in RCREG
+#define HAL_OERR		rcsta.1		// receive overrun
+#define HAL_CREN(v)		rcsta.4 = (v)	// clearing it resets an overrun
+
+// Timer 2 (string scan)
+#define HAL_TMR2IF			pir1.1
+#define HAL_TMR2IF_CLEAR()	pir1.1 = 0
+#define HAL_TMR2IE_ON		pie1.1
+#define HAL_TMR2IE(v)		pie1.1 = (v)
+#define HAL_TMR2			tmr2
+#define HAL_PR2(v)			pr2 = (v)
+
+// Timer 0 (system tick)
+#define HAL_TMR0IF			intcon.2
+#define HAL_TMR0IF_CLEAR()	intcon.2 = 0
+
+// Timer 1 (timestamps)
+#define HAL_TMR1H			tmr1h
+#define HAL_TMR1L			tmr1l
+
+// MSSP (shift register clock and data with SCAN_SPI)
+#define HAL_SSPBUF(c)		ssp1buf = (c)
+#define HAL_SSPIF			pir1.3		// transfer complete
+#define HAL_SSPIF_CLEAR()	pir1.3 = 0
+
+// Data EEPROM write in progress
+#define HAL_EEPROM_BUSY		eecon1.1
+
+// Global interrupt enable
+#define HAL_GIE(v)			intcon.7 = (v)
+
+// Called while waiting for an interrupt to do some work
+#define HAL_IDLE()
+
+#endif // STRUM_HOST
+
+#endif // STRUM_HAL_H
@@ -0,0 +1,211 @@
+////////////////////////////////////////////////////////////
+//
+// LE STRUM - CHORD INTERVAL TABLE GENERATOR
+//
+// The interval lists below are the reference for the chords
+// that stackTriads() builds. This program turns them into
+// the 12 bit masks that the firmware looks up in program
+// memory (ChordIntervals.h).
+//
+// usage: genchords > ../ChordIntervals.h
+//        genchords check
+//
+// "check" runs the firmware's chordMask() for every chord
+// type and extension and fails if any differs from the
+// intervals listed here
+//
+////////////////////////////////////////////////////////////
+#include <stdio.h>
+#include <string.h>
+
+typedef unsigned char byte;
+
+// these must match StrumController.c
+#define CHORD_TYPES		8
+#define EXTENSIONS		8
+#define NO_INTERVAL		0xff
+typedef struct
+{
+	byte chordType;
+	byte rootNote;
+	byte extension;
+} CHORD_SELECTION;
+
+// the firmware under test
+unsigned int chordMask(CHORD_SELECTION *pChordSelection);
+
+// By chord type, in the order of the CHORD_ values: the
+// intervals of the chord and the 7th that EXT_9TH adds
+static const struct {
+	const char *name;
+	byte intervals[5];
+	byte seventh;
+} chordTypes[CHORD_TYPES] = {
+	{ "none (as maj)",	{ 0, 4, 7, NO_INTERVAL },		10 },
+	{ "maj",			{ 0, 4, 7, NO_INTERVAL },		10 },
+	{ "min",			{ 0, 3, 7, NO_INTERVAL },		10 },
+	{ "dim",			{ 0, 3, 6, NO_INTERVAL },		9 },
+	{ "dom7",			{ 0, 4, 7, 10, NO_INTERVAL },	10 },
+	{ "maj7",			{ 0, 4, 7, 11, NO_INTERVAL },	11 },
+	{ "min7",			{ 0, 3, 7, 10, NO_INTERVAL },	10 },
+	{ "aug",			{ 0, 4, 8, NO_INTERVAL },		10 }
+};
+
+// By extension, in the order of the extension values: the
+// intervals it takes out, the ones it puts in and whether it
+// adds the chord type's 7th
+static const struct {
+	const char *name;
+	byte clear[3];
+	byte add[3];
+	byte seventh;
+} extensions[EXTENSIONS] = {
+	{ "none",				{ NO_INTERVAL },		{ NO_INTERVAL },	0 },
+	{ "sus4 (3rd to 4th)",	{ 3, 4, NO_INTERVAL },	{ 5, NO_INTERVAL },	0 },
+	{ "add6",				{ NO_INTERVAL },		{ 9, NO_INTERVAL },	0 },
+	{ "add9 (as 2nd)",		{ NO_INTERVAL },		{ 2, NO_INTERVAL },	0 },
+	{ "sus2 (3rd to 2nd)",	{ 3, 4, NO_INTERVAL },	{ 2, NO_INTERVAL },	0 },
+	{ "add11 (as 4th)",		{ NO_INTERVAL },		{ 5, NO_INTERVAL },	0 },
+	{ "9th (7th and 2nd)",	{ NO_INTERVAL },		{ 2, NO_INTERVAL },	1 },
+	{ "flat 5",				{ 7, 8, NO_INTERVAL },	{ 6, NO_INTERVAL },	0 }
+};
+
+static unsigned int maskOf(const byte *intervals)
+{
+	unsigned int mask = 0;
+	for(; *intervals != NO_INTERVAL; ++intervals)
+		mask |= 1 << *intervals;
+	return mask;
+}
+
+// the intervals of a chord, worked out from the lists
+static unsigned int referenceMask(int type, int ext)
+{
+	unsigned int mask = maskOf(chordTypes[type].intervals);
+	mask &= ~maskOf(extensions[ext].clear);
+	mask |= maskOf(extensions[ext].add);
+	if(extensions[ext].seventh)
+		mask |= 1 << chordTypes[type].seventh;
+	return mask;
+}
+
+////////////////////////////////////////////////////////////
+//
+// WRITE THE TABLES
+//
+////////////////////////////////////////////////////////////
+static void printWord(unsigned int value)
+{
+	printf("\\x%02x\\x%02x", value >> 8, value & 0xff);
+}
+
+static void printIntervals(const byte *intervals)
+{
+	if(*intervals == NO_INTERVAL)
+		printf(" -");
+	for(; *intervals != NO_INTERVAL; ++intervals)
+		printf(" %d", *intervals);
+}
+
+static int generate()
+{
+	int t, e;
+
+	printf(
+		"////////////////////////////////////////////////////////////\n"
+		"//\n"
+		"// LE STRUM - CHORD INTERVALS\n"
+		"//\n"
+		"// GENERATED FILE - DO NOT EDIT. Made by host/genchords.c\n"
+		"// from the reference interval lists (make intervals)\n"
+		"//\n"
+		"// The masks have bit n set for the note n semitones above\n"
+		"// the root and are 2 bytes per entry, high byte first. See\n"
+		"// stackTriads() for how they are put together\n"
+		"//\n"
+		"////////////////////////////////////////////////////////////\n"
+		"#ifndef CHORD_INTERVALS_H\n"
+		"#define CHORD_INTERVALS_H\n");
+
+	printf("\n// By chord type, the intervals of the chord\n");
+	printf("rom char *chordIntervals = \n");
+	for(t=0; t<CHORD_TYPES; ++t)
+	{
+		printf("\t\"");
+		printWord(maskOf(chordTypes[t].intervals));
+		printf("\"\t// %s:", chordTypes[t].name);
+		printIntervals(chordTypes[t].intervals);
+		printf("\n");
+	}
+	printf(";\n");
+
+	printf("\n// By chord type, the 7th added by EXT_9TH\n");
+	printf("rom char *chordSevenths = \n");
+	for(t=0; t<CHORD_TYPES; ++t)
+	{
+		printf("\t\"");
+		printWord(1 << chordTypes[t].seventh);
+		printf("\"\t// %s: %d\n", chordTypes[t].name, chordTypes[t].seventh);
+	}
+	printf(";\n");
+
+	printf("\n// By extension, intervals to clear, intervals to add and a\n");
+	printf("// mask for the 7th\n");
+	printf("rom char *chordExtensions = \n");
+	for(e=0; e<EXTENSIONS; ++e)
+	{
+		printf("\t\"");
+		printWord(maskOf(extensions[e].clear));
+		printWord(maskOf(extensions[e].add));
+		printWord(extensions[e].seventh? 0xffff : 0);
+		printf("\"\t// %s: clear", extensions[e].name);
+		printIntervals(extensions[e].clear);
+		printf(", add");
+		printIntervals(extensions[e].add);
+		printf("%s\n", extensions[e].seventh? ", 7th" : "");
+	}
+	printf(";\n\n#endif // CHORD_INTERVALS_H\n");
+	return 0;
+}
+
+////////////////////////////////////////////////////////////
+//
+// CHECK THE FIRMWARE AGAINST THE REFERENCE
+//
+////////////////////////////////////////////////////////////
+static int check()
+{
+	CHORD_SELECTION sel;
+	int t, e, errors = 0, count = 0;
+
+	for(t=0; t<CHORD_TYPES; ++t)
+		for(e=0; e<EXTENSIONS; ++e)
+		{
+			sel.chordType = t;
+			sel.rootNote = 0;
+			sel.extension = e;
+			unsigned int expect = referenceMask(t, e);
+			unsigned int got = chordMask(&sel);
+			++count;
+			if(expect != got)
+			{
+				printf("MISMATCH %s ext %s: expected %03x got %03x\n", chordTypes[t].name, extensions[e].name, expect, got);
+				++errors;
+			}
+		}
+
+	printf("genchords: %d chords checked, %d mismatches\n", count, errors);
+	return errors? 1 : 0;
+}
+
+int main(int argc, char *argv[])
+{
+	if(argc > 1 && !strcmp(argv[1], "check"))
+		return check();
+	if(argc > 1)
+	{
+		fprintf(stderr, "usage: genchords [check]\n");
+		return 1;
+	}
+	return generate();
+}
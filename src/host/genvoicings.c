@@ -0,0 +1,403 @@
+////////////////////////////////////////////////////////////
+//
+// LE STRUM - GUITAR VOICING TABLE GENERATOR
+//
+// The guitar chord shapes below are the reference for the
+// voicings. This program runs them for every chord type,
+// root and extension and writes the tables that the firmware
+// looks up in program memory (GuitarVoicings.h).
+//
+// usage: genvoicings > ../GuitarVoicings.h
+//        genvoicings check
+//
+// "check" runs the firmware's guitarChord() against the 
+// reference shapes for every combination, with and without 
+// bass notes, and fails if any note differs or if the roots
+// of columns 13-16 are not silent
+//
+////////////////////////////////////////////////////////////
+#include <stdio.h>
+#include <string.h>
+
+typedef unsigned char byte;
+
+// these must match StrumController.c
+#define NO_NOTE 				0xff
+#define OPT_GUITARBASSNOTES		0x0080
+enum { CHORD_NONE = 0b000, CHORD_MAJ = 0b001, CHORD_MIN = 0b010, CHORD_DOM7 = 0b100 };
+enum { ROOT_C, ROOT_CSHARP, ROOT_D, ROOT_DSHARP, ROOT_E, ROOT_F, ROOT_FSHARP, ROOT_G, ROOT_GSHARP, ROOT_A, ROOT_ASHARP, ROOT_B };
+enum { ADD_NONE, SUS_4, ADD_6, ADD_9 };
+typedef struct 
+{
+	byte chordType;
+	byte rootNote;
+	byte extension;
+} CHORD_SELECTION;
+
+// the firmware under test
+extern unsigned int options;
+byte guitarChord(CHORD_SELECTION *pChordSelection, byte transpose, byte *chord);
+
+static const struct {
+	byte type;
+	const char *name;
+} chordTypes[] = {
+	{ CHORD_MAJ, "major" },
+	{ CHORD_MIN, "minor" },
+	{ CHORD_DOM7, "dom7" }
+};
+static const char *rootNames[12] = { "C", "C#", "D", "D#", "E", "F", "F#", "G", "G#", "A", "A#", "B" };
+static const char *extensionNames[4] = { "None", "Sus4", "Add6", "Add9" };
+
+////////////////////////////////////////////////////////////
+//
+// REFERENCE GUITAR CHORD SHAPES
+// (as they were in StrumController.c, with the options
+// variable renamed)
+//
+////////////////////////////////////////////////////////////
+static unsigned int refOptions;
+
+static void guitarCShape(byte ofs, byte extension, byte *chord)
+{
+	if(refOptions & OPT_GUITARBASSNOTES)
+		chord[0] = 43 + ofs;
+	chord[1] = 48 + ofs;
+	chord[2] = 52 + ofs + (extension == SUS_4);
+	chord[3] = 55 + ofs + 2 * (extension == ADD_6);
+	chord[4] = 60 + ofs + 2 * (extension == ADD_9);
+	chord[5] = 64 + ofs + (extension == SUS_4);
+}
+static void guitarC7Shape(byte ofs, byte extension, byte *chord)
+{
+	if(refOptions & OPT_GUITARBASSNOTES)
+		chord[0] = 43 + ofs;
+	chord[1] = 48 + ofs;
+	chord[2] = 52 + ofs + (extension == SUS_4);
+	chord[3] = 58 + ofs - (extension == ADD_6);
+	chord[4] = 60 + ofs + 2 * (extension == ADD_9);
+	chord[5] = 64 + ofs + (extension == SUS_4);
+}
+static void guitarAShape(byte ofs, byte extension, byte *chord)
+{
+	if(refOptions & OPT_GUITARBASSNOTES)
+		chord[0] = 40 + ofs;
+	chord[1] = 45 + ofs;
+	chord[2] = 52 + ofs + 2 * (extension == ADD_6);
+	chord[3] = 57 + ofs + 2 * (extension == ADD_9);;
+	chord[4] = 61 + ofs + (extension == SUS_4);
+	chord[5] = 64 + ofs;
+}
+static void guitarAmShape(byte ofs, byte extension, byte *chord)
+{
+	if(refOptions & OPT_GUITARBASSNOTES)
+		chord[0] = 40 + ofs;
+	chord[1] = 45 + ofs;
+	chord[2] = 52 + ofs + 2 * (extension == ADD_6);
+	chord[3] = 57 + ofs + 2 * (extension == ADD_9);;
+	chord[4] = 60 + ofs  + 2 * (extension == SUS_4);
+	chord[5] = 64 + ofs;
+}
+static void guitarA7Shape(byte ofs, byte extension, byte *chord)
+{
+	if(refOptions & OPT_GUITARBASSNOTES)
+		chord[0] = 40 + ofs;
+	chord[1] = 45 + ofs;
+	chord[2] = 52 + ofs + 2 * (extension == ADD_6);
+	chord[3] = 55 + ofs + 4 * (extension == ADD_9);;
+	chord[4] = 61 + ofs + (extension == SUS_4);
+	chord[5] = 64 + ofs;
+}
+static void guitarDShape(byte ofs, byte extension, byte *chord)
+{
+	if(refOptions & OPT_GUITARBASSNOTES)
+		chord[1] = 45 + ofs;
+	chord[2] = 50 + ofs;
+	chord[3] = 57 + ofs + 2 * (extension == ADD_6);
+	chord[4] = 62 + ofs;
+	chord[5] = 66 + ofs  + (extension == SUS_4) - 2*(extension == ADD_9);
+}
+static void guitarDmShape(byte ofs, byte extension, byte *chord)
+{
+	if(refOptions & OPT_GUITARBASSNOTES)
+		chord[1] = 45 + ofs;
+	chord[2] = 50 + ofs;
+	chord[3] = 57 + ofs + 2 * (extension == ADD_6);
+	chord[4] = 62 + ofs;
+	chord[5] = 65 + ofs  + 2 * (extension == SUS_4) - (extension == ADD_9);
+}
+static void guitarD7Shape(byte ofs, byte extension, byte *chord)
+{
+	if(refOptions & OPT_GUITARBASSNOTES)
+		chord[1] = 45 + ofs;
+	chord[2] = 50 + ofs;
+	chord[3] = 57 + ofs + 2 * (extension == ADD_6);
+	chord[4] = 60 + ofs;
+	chord[5] = 66 + ofs  + (extension == SUS_4)- 2*(extension == ADD_9);
+}
+static void guitarEShape(byte ofs, byte extension, byte *chord)
+{
+	chord[0] = 40 + ofs;
+	chord[1] = 47 + ofs;
+	chord[2] = 52 + ofs + 2 * (extension == ADD_9);
+	chord[3] = 56 + ofs  + (extension == SUS_4);
+	chord[4] = 59 + ofs + 2 * (extension == ADD_6);
+	chord[5] = 64 + ofs;
+}
+static void guitarEmShape(byte ofs, byte extension, byte *chord)
+{
+	chord[0] = 40 + ofs;
+	chord[1] = 47 + ofs;
+	chord[2] = 52 + ofs + 2 * (extension == ADD_9);
+	chord[3] = 55 + ofs  + 2 * (extension == SUS_4);
+	chord[4] = 59 + ofs + 2 * (extension == ADD_6);
+	chord[5] = 64 + ofs;
+}
+static void guitarE7Shape(byte ofs, byte extension, byte *chord)
+{
+	chord[0] = 40 + ofs;
+	chord[1] = 47 + ofs;
+	chord[2] = 50 + ofs + 4 * (extension == ADD_9);
+	chord[3] = 56 + ofs  + (extension == SUS_4);
+	chord[4] = 59 + ofs + 2 * (extension == ADD_6);
+	chord[5] = 64 + ofs;
+}
+static void guitarGShape(byte ofs, byte extension, byte *chord)
+{
+	chord[0] = 43 + ofs;
+	chord[1] = 47 + ofs  + (extension == SUS_4);
+	chord[2] = 50 + ofs + 2 * (extension == ADD_6);
+	chord[3] = 55 + ofs  + 2*(extension == ADD_9);
+	chord[4] = 59 + ofs + (extension == SUS_4);
+	chord[5] = 67 + ofs;
+}
+
+static byte referenceChord(CHORD_SELECTION *pChordSelection, byte transpose, byte *chord)
+{	
+	memset(chord, NO_NOTE, 16);
+	switch(pChordSelection->chordType)
+	{
+		case CHORD_MAJ:
+			switch(pChordSelection->rootNote)
+			{
+			case ROOT_C:		guitarCShape(0, pChordSelection->extension, chord);	break;
+			case ROOT_CSHARP:  	guitarAShape(4, pChordSelection->extension, chord);	break;
+			case ROOT_D:		guitarDShape(0, pChordSelection->extension, chord);	break;
+			case ROOT_DSHARP:	guitarAShape(6, pChordSelection->extension, chord);	break;
+			case ROOT_E:		guitarEShape(0, pChordSelection->extension, chord);	break;
+			case ROOT_F:		guitarEShape(1, pChordSelection->extension, chord);	break;
+			case ROOT_FSHARP:	guitarEShape(2, pChordSelection->extension, chord);	break;
+			case ROOT_G:		guitarGShape(0, pChordSelection->extension, chord);	break;
+			case ROOT_GSHARP:	guitarEShape(4, pChordSelection->extension, chord);	break;
+			case ROOT_A:		guitarAShape(0, pChordSelection->extension, chord);	break;
+			case ROOT_ASHARP:   guitarAShape(1, pChordSelection->extension, chord);	break;
+			case ROOT_B:   		guitarAShape(2, pChordSelection->extension, chord);	break;
+			}
+			break;
+		case CHORD_MIN:
+			switch(pChordSelection->rootNote)
+			{
+			case ROOT_C:		guitarAmShape(3, pChordSelection->extension, chord);	break;
+			case ROOT_CSHARP:  	guitarAmShape(4, pChordSelection->extension, chord);	break;
+			case ROOT_D:		guitarDmShape(0, pChordSelection->extension, chord);	break;
+			case ROOT_DSHARP:	guitarAmShape(6, pChordSelection->extension, chord);	break;
+			case ROOT_E:		guitarEmShape(0, pChordSelection->extension, chord);	break;
+			case ROOT_F:		guitarEmShape(1, pChordSelection->extension, chord);	break;
+			case ROOT_FSHARP:	guitarEmShape(2, pChordSelection->extension, chord);	break;
+			case ROOT_G:		guitarEmShape(3, pChordSelection->extension, chord);	break;
+			case ROOT_GSHARP:	guitarEmShape(4, pChordSelection->extension, chord);	break;
+			case ROOT_A:		guitarAmShape(0, pChordSelection->extension, chord);	break;
+			case ROOT_ASHARP:   guitarAmShape(1, pChordSelection->extension, chord);	break;
+			case ROOT_B:   		guitarAmShape(2, pChordSelection->extension, chord);	break;
+			}
+			break;
+		case CHORD_DOM7:
+			switch(pChordSelection->rootNote)
+			{
+			case ROOT_C:		guitarC7Shape(0, pChordSelection->extension, chord);	break;
+			case ROOT_CSHARP:  	guitarA7Shape(4, pChordSelection->extension, chord);	break;
+			case ROOT_D:		guitarD7Shape(0, pChordSelection->extension, chord);	break;
+			case ROOT_DSHARP:	guitarA7Shape(6, pChordSelection->extension, chord);	break;
+			case ROOT_E:		guitarE7Shape(0, pChordSelection->extension, chord);	break;
+			case ROOT_F:		guitarE7Shape(1, pChordSelection->extension, chord);	break;
+			case ROOT_FSHARP:	guitarE7Shape(2, pChordSelection->extension, chord);	break;
+			case ROOT_G:		guitarE7Shape(3, pChordSelection->extension, chord);	break;
+			case ROOT_GSHARP:	guitarE7Shape(4, pChordSelection->extension, chord);	break;
+			case ROOT_A:		guitarA7Shape(0, pChordSelection->extension, chord);	break;
+			case ROOT_ASHARP:   guitarA7Shape(1, pChordSelection->extension, chord);	break;
+			case ROOT_B:   		guitarA7Shape(2, pChordSelection->extension, chord);	break;
+			}
+			break;
+		default:
+			return 0;
+	}	
+	for(int i=0;i<16;++i)
+		if(chord[i] != NO_NOTE)
+			chord[i] += transpose;
+	return 6;
+}
+
+////////////////////////////////////////////////////////////
+//
+// WRITE THE TABLES
+//
+////////////////////////////////////////////////////////////
+static void printNotes(const byte *notes, const char *comment)
+{
+	int i;
+	printf("\t\"");
+	for(i=0; i<6; ++i)
+		printf("\\x%02x", notes[i]);
+	printf("\"\t// %s\n", comment);
+}
+
+static int generate()
+{
+	CHORD_SELECTION sel;
+	byte full[16], plain[16], mask[3][12];
+	char comment[32];
+	int t, r, e, i;
+
+	printf(
+		"////////////////////////////////////////////////////////////\n"
+		"//\n"
+		"// LE STRUM - GUITAR CHORD VOICINGS\n"
+		"//\n"
+		"// GENERATED FILE - DO NOT EDIT. Made by host/genvoicings.c\n"
+		"// from the reference chord shapes (make voicings)\n"
+		"//\n"
+		"// There is a table for each chord extension so that none\n"
+		"// is over 256 bytes. Each has 6 notes, low string first,\n"
+		"// for each root of the major, minor and dom7 chords, with\n"
+		"// NO_NOTE for unplayed strings. guitarBassStrings flags the\n"
+		"// strings that only sound with OPT_GUITARBASSNOTES\n"
+		"//\n"
+		"////////////////////////////////////////////////////////////\n"
+		"#ifndef GUITAR_VOICINGS_H\n"
+		"#define GUITAR_VOICINGS_H\n");
+
+	for(e=0; e<4; ++e)
+	{
+		printf("\nrom char *guitarVoicings%s = \n", extensionNames[e]);
+		for(t=0; t<3; ++t)
+		{
+			for(r=0; r<12; ++r)
+			{
+				sel.chordType = chordTypes[t].type;
+				sel.rootNote = r;
+				sel.extension = e;
+				refOptions = OPT_GUITARBASSNOTES;
+				referenceChord(&sel, 0, full);
+				refOptions = 0;
+				referenceChord(&sel, 0, plain);
+
+				// bass strings are the ones that go quiet
+				byte m = 0;
+				for(i=0; i<6; ++i)
+					if(full[i] != plain[i])
+					{
+						if(plain[i] != NO_NOTE)
+						{
+							fprintf(stderr, "genvoicings: bass notes change a played string\n");
+							return 1;
+						}
+						m |= (1<<i);
+					}
+				if(e && m != mask[t][r])
+				{
+					fprintf(stderr, "genvoicings: bass strings depend on extension\n");
+					return 1;
+				}
+				mask[t][r] = m;
+
+				snprintf(comment, sizeof(comment), "%s %s", rootNames[r], chordTypes[t].name);
+				printNotes(full, comment);
+			}
+		}
+		printf(";\n");
+	}
+
+	printf("\nrom char *guitarBassStrings = \n");
+	for(t=0; t<3; ++t)
+	{
+		printf("\t\"");
+		for(r=0; r<12; ++r)
+			printf("\\x%02x", mask[t][r]);
+		printf("\"\t// %s\n", chordTypes[t].name);
+	}
+	printf(";\n\n#endif // GUITAR_VOICINGS_H\n");
+	return 0;
+}
+
+////////////////////////////////////////////////////////////
+//
+// CHECK THE FIRMWARE AGAINST THE REFERENCE
+//
+////////////////////////////////////////////////////////////
+static int check()
+{
+	CHORD_SELECTION sel;
+	byte expect[16], got[16];
+	int t, r, e, bass, errors = 0, count = 0;
+
+	for(bass=0; bass<2; ++bass)
+		for(t=0; t<3; ++t)
+			for(r=0; r<12; ++r)
+				for(e=0; e<4; ++e)
+				{
+					sel.chordType = chordTypes[t].type;
+					sel.rootNote = r;
+					sel.extension = e;
+					refOptions = bass? OPT_GUITARBASSNOTES : 0;
+					options = refOptions;
+					byte expectLen = referenceChord(&sel, 12, expect);
+					byte gotLen = guitarChord(&sel, 12, got);
+					++count;
+					if(expectLen != gotLen || memcmp(expect, got, 16))
+					{
+						printf("MISMATCH %s %s ext %s bass %d\n", rootNames[r], chordTypes[t].name, extensionNames[e], bass);
+						++errors;
+					}
+				}
+
+	// there are no shapes for columns 13-16
+	options = 0;
+	for(t=0; t<3; ++t)
+		for(r=12; r<16; ++r)
+		{
+			sel.chordType = chordTypes[t].type;
+			sel.rootNote = r;
+			sel.extension = 0;
+			memset(expect, NO_NOTE, sizeof(expect));
+			if(guitarChord(&sel, 12, got) != 6 || memcmp(expect, got, 16))
+			{
+				printf("MISMATCH column %d %s not silent\n", r + 1, chordTypes[t].name);
+				++errors;
+			}
+		}
+
+	// anything else is not a guitar chord
+	sel.chordType = CHORD_NONE;
+	sel.rootNote = 0;
+	sel.extension = 0;
+	if(guitarChord(&sel, 12, got))
+	{
+		printf("MISMATCH no chord\n");
+		++errors;
+	}
+
+	printf("genvoicings: %d voicings checked, %d mismatches\n", count, errors);
+	return errors? 1 : 0;
+}
+
+int main(int argc, char *argv[])
+{
+	if(argc > 1 && !strcmp(argv[1], "check"))
+		return check();
+	if(argc > 1)
+	{
+		fprintf(stderr, "usage: genvoicings [check]\n");
+		return 1;
+	}
+	return generate();
+}
@@ -0,0 +1,332 @@
+////////////////////////////////////////////////////////////
+//
+// LE STRUM - MEMORY REPORT
+//
+// Reports the frame size of every firmware function, the
+// deepest call chains against the 16 level hardware stack of
+// the PIC16F1825, and a map of the global RAM.
+//
+// usage: memreport callgraph.ci symbols.nm [source...]
+//
+// The call graph and frame sizes come from building the
+// firmware with gcc -fstack-usage -fcallgraph-info=su, and the
+// globals from "nm -S" of the same object (see make memory).
+// Globals declared "rom" in the sources are in program memory
+// on the PIC, so they are left out of the RAM map.
+//
+// These are host figures. Frames are x86-64 frames at -O0 and
+// ints and pointers are bigger than on the PIC, so the byte
+// counts are for comparing builds, not a budget. SourceBoost
+// reports the real RAM use when it links. The call depth is
+// the same on both, except for any maths helpers the PIC
+// compiler calls, which is why the report leaves headroom
+//
+////////////////////////////////////////////////////////////
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define MAX_FUNCTIONS	256
+#define MAX_CALLS		1024
+#define MAX_GLOBALS		256
+#define MAX_ROM			64
+#define NAME_LEN		64
+
+// hardware stack levels, and the levels a chain may use before
+// it is flagged
+#define STACK_LEVELS	16
+#define STACK_HEADROOM	2
+
+typedef struct {
+	char name[NAME_LEN];
+	int frame;			// bytes, -1 if not in the firmware
+	int hal;			// a simulator function, which is a register access on the PIC
+	int depth;			// deepest chain of calls below, -1 if not worked out yet
+	int bytes;			// frame bytes on that chain, including this one
+	int next;			// the callee on it, -1 for none
+	int visiting;
+} FUNCTION;
+
+typedef struct {
+	int from;
+	int to;
+} CALL;
+
+typedef struct {
+	char name[NAME_LEN];
+	unsigned long size;
+} GLOBAL;
+
+static FUNCTION functions[MAX_FUNCTIONS];
+static int functionCount = 0;
+static CALL calls[MAX_CALLS];
+static int callCount = 0;
+static GLOBAL globals[MAX_GLOBALS];
+static int globalCount = 0;
+static char romNames[MAX_ROM][NAME_LEN];
+static int romCount = 0;
+
+static int findFunction(const char *name)
+{
+	int i;
+	for(i=0; i<functionCount; ++i)
+		if(!strcmp(functions[i].name, name))
+			return i;
+	if(functionCount == MAX_FUNCTIONS)
+	{
+		fprintf(stderr, "too many functions\n");
+		exit(1);
+	}
+	FUNCTION *f = &functions[functionCount];
+	snprintf(f->name, NAME_LEN, "%s", name);
+	f->frame = -1;
+	f->hal = !strncmp(name, "sim", 3);
+	f->depth = -1;
+	f->next = -1;
+	return functionCount++;
+}
+
+// Copy the quoted string after key in line
+static int quoted(const char *line, const char *key, char *out)
+{
+	const char *p = strstr(line, key);
+	int n = 0;
+	if(!p)
+		return 0;
+	p += strlen(key);
+	while(*p && *p != '"' && n < NAME_LEN-1)
+	{
+		if(*p == '\\' && p[1])
+			break;	// the name ends at the first \n of a label
+		out[n++] = *p++;
+	}
+	out[n] = 0;
+	return 1;
+}
+
+////////////////////////////////////////////////////////////
+// Read the call graph. A node with a frame size is a
+// function of the firmware, one without is external
+static int loadCallGraph(const char *path)
+{
+	FILE *f = fopen(path, "r");
+	char line[1024], a[NAME_LEN], b[NAME_LEN];
+	if(!f)
+	{
+		perror(path);
+		return 0;
+	}
+	while(fgets(line, sizeof(line), f))
+	{
+		if(!strncmp(line, "node:", 5) && quoted(line, "title: \"", a))
+		{
+			const char *p = strstr(line, " bytes (");
+			int i = findFunction(a);
+			if(p)
+			{
+				while(p > line && p[-1] >= '0' && p[-1] <= '9')
+					--p;
+				functions[i].frame = atoi(p);
+			}
+		}
+		else if(!strncmp(line, "edge:", 5) && quoted(line, "sourcename: \"", a) && quoted(line, "targetname: \"", b))
+		{
+			if(callCount == MAX_CALLS)
+			{
+				fprintf(stderr, "too many calls\n");
+				exit(1);
+			}
+			calls[callCount].from = findFunction(a);
+			calls[callCount].to = findFunction(b);
+			++callCount;
+		}
+	}
+	fclose(f);
+	return 1;
+}
+
+////////////////////////////////////////////////////////////
+// Collect the names of rom tables from the sources
+static int loadRomNames(const char *path)
+{
+	FILE *f = fopen(path, "r");
+	char line[1024];
+	if(!f)
+	{
+		perror(path);
+		return 0;
+	}
+	while(fgets(line, sizeof(line), f))
+	{
+		char *p = line;
+		int n = 0;
+		if(strncmp(line, "rom ", 4) || romCount == MAX_ROM)
+			continue;
+		while(*p && *p != '*')
+			++p;
+		if(!*p++)
+			continue;
+		while(*p == ' ')
+			++p;
+		while(n < NAME_LEN-1 && (*p == '_' || (*p >= 'a' && *p <= 'z') || (*p >= 'A' && *p <= 'Z') || (*p >= '0' && *p <= '9')))
+			romNames[romCount][n++] = *p++;
+		romNames[romCount][n] = 0;
+		if(n)
+			++romCount;
+	}
+	fclose(f);
+	return 1;
+}
+
+static int isRom(const char *name)
+{
+	int i;
+	for(i=0; i<romCount; ++i)
+		if(!strcmp(romNames[i], name))
+			return 1;
+	return 0;
+}
+
+////////////////////////////////////////////////////////////
+// Read the data and bss symbols from nm -S
+static int loadGlobals(const char *path)
+{
+	FILE *f = fopen(path, "r");
+	char line[256], name[NAME_LEN], type;
+	unsigned long addr, size;
+	if(!f)
+	{
+		perror(path);
+		return 0;
+	}
+	while(fgets(line, sizeof(line), f))
+	{
+		if(sscanf(line, "%lx %lx %c %63s", &addr, &size, &type, name) != 4)
+			continue;
+		if(!strchr("bBdD", type) || isRom(name) || globalCount == MAX_GLOBALS)
+			continue;
+		snprintf(globals[globalCount].name, NAME_LEN, "%s", name);
+		globals[globalCount].size = size;
+		++globalCount;
+	}
+	fclose(f);
+	return 1;
+}
+
+////////////////////////////////////////////////////////////
+// Work out the deepest chain of calls below a function. Each
+// call into the firmware or a library takes a stack level,
+// a simulator call does not
+static int walk(int i)
+{
+	FUNCTION *f = &functions[i];
+	int c;
+	if(f->depth >= 0)
+		return f->depth;
+	if(f->visiting)
+	{
+		fprintf(stderr, "%s is recursive\n", f->name);
+		return 0;
+	}
+	f->visiting = 1;
+	f->depth = 0;
+	f->bytes = f->frame > 0? f->frame : 0;
+	for(c=0; c<callCount; ++c)
+	{
+		int to = calls[c].to;
+		int depth, bytes;
+		if(calls[c].from != i || functions[to].hal)
+			continue;
+		depth = 1 + walk(to);
+		bytes = (f->frame > 0? f->frame : 0) + functions[to].bytes;
+		if(depth > f->depth || (depth == f->depth && bytes > f->bytes))
+		{
+			f->depth = depth;
+			f->bytes = bytes;
+			f->next = to;
+		}
+	}
+	f->visiting = 0;
+	return f->depth;
+}
+
+static void printChain(int i)
+{
+	printf("    %s", functions[i].name);
+	for(i = functions[i].next; i >= 0; i = functions[i].next)
+		printf(" > %s", functions[i].name);
+	printf("\n");
+}
+
+static int byFrame(const void *a, const void *b)
+{
+	return ((const FUNCTION *)b)->frame - ((const FUNCTION *)a)->frame;
+}
+
+static int bySize(const void *a, const void *b)
+{
+	const GLOBAL *ga = a, *gb = b;
+	return (gb->size > ga->size) - (gb->size < ga->size);
+}
+
+////////////////////////////////////////////////////////////
+int main(int argc, char *argv[])
+{
+	static const char *roots[] = { "startup", "pollIO", "interrupt" };
+	FUNCTION sorted[MAX_FUNCTIONS];
+	unsigned long total = 0;
+	int i, levels, isr, worst;
+
+	if(argc < 3)
+	{
+		fprintf(stderr, "usage: memreport callgraph.ci symbols.nm [source...]\n");
+		return 1;
+	}
+	if(!loadCallGraph(argv[1]))
+		return 1;
+	for(i=3; i<argc; ++i)
+		if(!loadRomNames(argv[i]))
+			return 1;
+	if(!loadGlobals(argv[2]))
+		return 1;
+	for(i=0; i<functionCount; ++i)
+		walk(i);
+
+	// frames, biggest first
+	memcpy(sorted, functions, sizeof(FUNCTION) * functionCount);
+	qsort(sorted, functionCount, sizeof(FUNCTION), byFrame);
+	printf("function frames (host bytes at -O0)\n");
+	printf("  %5s %5s %6s  %s\n", "frame", "depth", "chain", "function");
+	for(i=0; i<functionCount && sorted[i].frame >= 0; ++i)
+		printf("  %5d %5d %6d  %s\n", sorted[i].frame, sorted[i].depth, sorted[i].bytes, sorted[i].name);
+
+	// call depth from each entry point. The interrupt can come
+	// at the deepest point of the main loop, and main itself is
+	// one level below startup and pollIO
+	printf("\ncall depth (%d hardware stack levels)\n", STACK_LEVELS);
+	levels = isr = 0;
+	for(i=0; i<(int)(sizeof(roots)/sizeof(roots[0])); ++i)
+	{
+		int f = findFunction(roots[i]);
+		printf("  %-10s %2d levels %6d bytes\n", roots[i], functions[f].depth + 1, functions[f].bytes);
+		printChain(f);
+		if(!strcmp(roots[i], "interrupt"))
+			isr = functions[f].depth + 1;
+		else if(functions[f].depth + 1 > levels)
+			levels = functions[f].depth + 1;
+	}
+	worst = levels + isr;
+	printf("  worst case %2d levels (main loop %d + interrupt %d)%s\n", worst, levels, isr,
+		worst > STACK_LEVELS - STACK_HEADROOM? " OVER BUDGET" : "");
+
+	// globals, biggest first
+	qsort(globals, globalCount, sizeof(GLOBAL), bySize);
+	printf("\nglobal RAM (host bytes, %d rom tables left out)\n", romCount);
+	for(i=0; i<globalCount; ++i)
+	{
+		printf("  %5lu  %s\n", globals[i].size, globals[i].name);
+		total += globals[i].size;
+	}
+	printf("  %5lu  total\n", total);
+	return worst > STACK_LEVELS - STACK_HEADROOM;
+}
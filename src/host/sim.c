@@ -0,0 +1,703 @@
+////////////////////////////////////////////////////////////
+//
+// LE STRUM - HOST SIMULATOR
+//
+////////////////////////////////////////////////////////////
+#include <stdio.h>
+#include <stdlib.h>
+#include "sim.h"
+
+SIM sim;
+
+// length of a timer 2 period for a given period register
+#define T2_PERIOD(pr2) ((SIM_TIME)((pr2) + 1) * SIM_T2_TICK_NS)
+
+static void shiftClock(void);
+
+////////////////////////////////////////////////////////////
+//
+// RESET THE SIMULATED HARDWARE
+//
+////////////////////////////////////////////////////////////
+void simReset()
+{
+	memset(&sim, 0, sizeof(sim));
+	memset(sim.eeprom, 0xff, sizeof(sim.eeprom));
+	sim.clk = 1;
+	sim.sysexPos = -1;
+	simDefaultSettle();
+}
+
+////////////////////////////////////////////////////////////
+//
+// DEFAULT SETTLE TIMES
+// A plausible unit: the stylus lines settle in 30-105us,
+// getting slower along the shift register chain, and the
+// chord button lines take 80us
+//
+////////////////////////////////////////////////////////////
+void simDefaultSettle()
+{
+	int i;
+	for(i=0; i<SIM_STRINGS; ++i)
+	{
+		sim.settleStylus[i] = SIM_US(30 + 5*i);
+		sim.settleKeys[i] = SIM_US(80);
+	}
+}
+
+////////////////////////////////////////////////////////////
+//
+// SCHEDULE A CHANGE TO THE PHYSICAL INPUTS
+//
+////////////////////////////////////////////////////////////
+void simInput(SIM_TIME t, unsigned int stylus, unsigned int keys1, unsigned int keys2, unsigned int keys3, unsigned char mode, int tag)
+{
+	SIM_INPUT *p;
+	if(sim.scriptLen >= SIM_MAX_INPUTS)
+	{
+		fprintf(stderr, "sim: input script full\n");
+		exit(1);
+	}
+	if(sim.scriptLen && t < sim.script[sim.scriptLen-1].t)
+	{
+		fprintf(stderr, "sim: input script must be in time order\n");
+		exit(1);
+	}
+	p = &sim.script[sim.scriptLen++];
+	p->t = t;
+	p->stylus = stylus;
+	p->keys[0] = keys1;
+	p->keys[1] = keys2;
+	p->keys[2] = keys3;
+	p->mode = mode;
+	p->tag = tag;
+}
+
+int simScriptDone()
+{
+	return sim.scriptPos >= sim.scriptLen;
+}
+
+////////////////////////////////////////////////////////////
+//
+// SCHEDULE BYTES AT MIDI IN
+// They follow each other as fast as the line allows, starting
+// at t or when the last scheduled byte is done if that is 
+// later. Returns when the last one is done
+//
+////////////////////////////////////////////////////////////
+static SIM_TIME midiInSchedule(SIM_TIME t, unsigned char c, unsigned char ferr)
+{
+	SIM_MIDI_IN *p;
+	if(sim.midiInLen >= SIM_MAX_MIDI_IN)
+	{
+		fprintf(stderr, "sim: MIDI in script full\n");
+		exit(1);
+	}
+	if(sim.midiInLen && t < sim.midiIn[sim.midiInLen-1].t)
+		t = sim.midiIn[sim.midiInLen-1].t;
+	p = &sim.midiIn[sim.midiInLen++];
+	p->t = t + SIM_MIDI_BYTE_NS;
+	p->c = c;
+	p->ferr = ferr;
+	return p->t;
+}
+
+SIM_TIME simMidiIn(SIM_TIME t, const unsigned char *bytes, int len)
+{
+	while(len--)
+		t = midiInSchedule(t, *bytes++, 0);
+	return t;
+}
+
+// a byte with a framing error, as when a cable is plugged in
+SIM_TIME simMidiInError(SIM_TIME t)
+{
+	return midiInSchedule(t, 0, 1);
+}
+
+////////////////////////////////////////////////////////////
+//
+// LOG A COMPLETED BYTE FROM THE USART AND PARSE IT INTO
+// MIDI MESSAGES (INCLUDING RUNNING STATUS)
+//
+////////////////////////////////////////////////////////////
+static int dataLength(unsigned char status)
+{
+	switch(status & 0xf0)
+	{
+		case 0xc0: case 0xd0: return 1;
+		case 0xf0:
+			switch(status)
+			{
+				case 0xf1: case 0xf3: return 1;
+				case 0xf2: return 2;
+				default: return 0;
+			}
+		default: return 2;
+	}
+}
+
+static void logMidi(SIM_TIME start, SIM_TIME end, unsigned char status, unsigned char *data, unsigned char len)
+{
+	SIM_MIDI *p;
+	if(sim.midiLen >= SIM_MAX_MIDI)
+		return;
+	p = &sim.midi[sim.midiLen++];
+	p->start = start;
+	p->end = end;
+	p->status = status;
+	p->data[0] = data? data[0] : 0;
+	p->data[1] = data? data[1] : 0;
+	p->len = len;
+}
+
+static void rxByte(unsigned char c, SIM_TIME start, SIM_TIME end)
+{
+	++sim.txBytes;
+	if(sim.rawOut)
+		fputc(c, sim.rawOut);
+	if(c >= 0xf8)
+	{
+		// realtime, does not disturb running status
+		logMidi(start, end, c, NULL, 1);
+		return;
+	}
+	if(c == 0xf0)
+	{
+		sim.sysexPos = 0;
+		sim.sysexLen = 0;
+	}
+	if(sim.sysexPos >= 0 && sim.sysexPos < SIM_MAX_SYSEX)
+		sim.sysex[sim.sysexPos++] = c;
+	if(c == 0xf7 && sim.sysexPos > 0)
+	{
+		sim.sysexLen = sim.sysexPos;
+		if(sim.sysexLogLen + sim.sysexLen <= SIM_MAX_SYSEX_LOG)
+		{
+			memcpy(&sim.sysexLog[sim.sysexLogLen], sim.sysex, sim.sysexLen);
+			sim.sysexLogLen += sim.sysexLen;
+		}
+	}
+	if((c & 0x80) && c != 0xf0)
+		sim.sysexPos = -1;
+	if(c & 0x80)
+	{
+		// channel or system common message with data to come
+		sim.rxStatus = (c < 0xf0 || dataLength(c))? c : 0;
+		sim.rxCount = 0;
+		sim.rxStart = start;
+		sim.rxStatusSent = 1;
+		if(!sim.rxStatus)
+			logMidi(start, end, c, NULL, 1);
+		return;
+	}
+	if(!sim.rxStatus)
+		return;	// sysex data or stray bytes
+	if(!sim.rxCount && !sim.rxStatusSent)
+		sim.rxStart = start;	// running status
+	sim.rxData[sim.rxCount++] = c;
+	if(sim.rxCount == dataLength(sim.rxStatus))
+	{
+		logMidi(sim.rxStart, end, sim.rxStatus, sim.rxData, sim.rxCount + sim.rxStatusSent);
+		sim.rxCount = 0;
+		sim.rxStatusSent = 0;
+		if(sim.rxStatus >= 0xf0)
+			sim.rxStatus = 0;	// no running status for system common
+	}
+}
+
+////////////////////////////////////////////////////////////
+//
+// ADVANCE VIRTUAL TIME
+//
+////////////////////////////////////////////////////////////
+static void startTsr(unsigned char c)
+{
+	sim.tsr = c;
+	sim.tsrBusy = 1;
+	sim.tsrStart = sim.now;
+	sim.tsrDone = sim.now + SIM_MIDI_BYTE_NS;
+}
+
+static int interruptPending()
+{
+	if(!sim.gie || sim.inIsr)
+		return 0;
+	if(sim.peie && sim.txie && !sim.txregFull)
+		return 1;
+	if(sim.peie && sim.tmr2ie && sim.tmr2if)
+		return 1;
+	if(sim.peie && sim.rcie && sim.rcCount)
+		return 1;
+	if(sim.tmr0ie && sim.tmr0if)
+		return 1;
+	return 0;
+}
+
+void simAdvance(SIM_TIME ns)
+{
+	SIM_TIME target = sim.now + ns;
+	if(sim.limit && sim.now > sim.limit)
+	{
+		fprintf(stderr, "sim: firmware still busy at %.3fms, giving up\n", sim.now/1e6);
+		exit(1);
+	}
+	for(;;)
+	{
+		// run the interrupt handler, which takes the time
+		// it takes in addition to whatever was going on
+		if(interruptPending())
+		{
+			sim.inIsr = 1;
+			++sim.interrupts;
+			simAdvance(SIM_ISR_NS);
+			interrupt();
+			sim.inIsr = 0;
+			continue;
+		}
+
+		// find the next thing that happens
+		SIM_TIME next = target;
+		if(sim.tsrBusy && sim.tsrDone < next)
+			next = sim.tsrDone;
+		if(sim.scriptPos < sim.scriptLen && sim.script[sim.scriptPos].t < next)
+			next = sim.script[sim.scriptPos].t;
+		if(sim.t2on && sim.t2Next < next)
+			next = sim.t2Next;
+		if(sim.t0on && sim.t0Next < next)
+			next = sim.t0Next;
+		if(sim.sspBits && sim.sspNext < next)
+			next = sim.sspNext;
+		if(sim.midiInPos < sim.midiInLen && sim.midiIn[sim.midiInPos].t < next)
+			next = sim.midiIn[sim.midiInPos].t;
+		if(next > sim.now)
+			sim.now = next;
+
+		// apply input changes
+		while(sim.scriptPos < sim.scriptLen && sim.script[sim.scriptPos].t <= sim.now)
+			sim.in = sim.script[sim.scriptPos++];
+
+		// timer 2 matched the period register
+		if(sim.t2on && sim.t2Next <= sim.now)
+		{
+			sim.tmr2if = 1;
+			sim.t2Next += T2_PERIOD(sim.pr2);
+			continue;
+		}
+
+		// timer 0 overflowed
+		if(sim.t0on && sim.t0Next <= sim.now)
+		{
+			sim.tmr0if = 1;
+			sim.t0Next += SIM_T0_PERIOD_NS;
+			continue;
+		}
+
+		// SPI clock edge, which shifts the next bit into the
+		// shift register
+		if(sim.sspBits && sim.sspNext <= sim.now)
+		{
+			sim.ds = !!(sim.sspData & 0x80);
+			sim.sspData <<= 1;
+			shiftClock();
+			if(--sim.sspBits)
+				sim.sspNext += SIM_SSP_BIT_NS;
+			else
+				sim.sspif = 1;
+			continue;
+		}
+
+		// byte received. The FIFO holds 2 and a third sets OERR,
+		// after which nothing more is received until CREN is 
+		// cleared
+		if(sim.midiInPos < sim.midiInLen && sim.midiIn[sim.midiInPos].t <= sim.now)
+		{
+			SIM_MIDI_IN *p = &sim.midiIn[sim.midiInPos++];
+			if(!sim.cren || sim.oerr)
+				++sim.rcLost;
+			else if(sim.rcCount == 2)
+			{
+				sim.oerr = 1;
+				++sim.rcLost;
+			}
+			else
+			{
+				sim.rcFifo[sim.rcCount] = p->c;
+				sim.rcFerr[sim.rcCount] = p->ferr;
+				++sim.rcCount;
+				++sim.rcBytes;
+			}
+			continue;
+		}
+
+		// USART byte completed
+		if(sim.tsrBusy && sim.tsrDone <= sim.now)
+		{
+			sim.tsrBusy = 0;
+			rxByte(sim.tsr, sim.tsrStart, sim.tsrDone);
+			if(sim.txregFull)
+			{
+				sim.txregFull = 0;
+				startTsr(sim.txreg);
+			}
+			continue;
+		}
+		if(sim.now >= target)
+			break;
+	}
+}
+
+////////////////////////////////////////////////////////////
+//
+// SHIFT REGISTER AND INPUTS
+//
+////////////////////////////////////////////////////////////
+static int lowestColumn(unsigned int outputs)
+{
+	int i;
+	for(i=0; i<SIM_STRINGS; ++i)
+		if(outputs & (1<<i))
+			return i;
+	return -1;
+}
+
+// the outputs as currently seen by an input line with the given settle times.
+// When every output goes off the line takes as long to fall as the
+// column it last saw took to settle
+static unsigned int settledOutputs(unsigned int *settled, SIM_TIME *settle)
+{
+	int col = lowestColumn(sim.latch);
+	if(col < 0)
+		col = lowestColumn(*settled);
+	if(col < 0 || sim.now >= sim.latchTime + settle[col])
+		*settled = sim.latch;
+	return *settled;
+}
+
+// rising edge on the shift register clock
+static void shiftClock(void)
+{
+	// store clock is tied to shift clock, so the
+	// outputs latch the value from before the shift
+	settledOutputs(&sim.settledStylus, sim.settleStylus);
+	settledOutputs(&sim.settledKeys, sim.settleKeys);
+	sim.latchTime = sim.now;
+	sim.latch = sim.shift;
+	sim.shift = ((sim.shift << 1) | sim.ds) & 0xffff;
+	++sim.clocks;
+}
+
+void simClk(unsigned char v)
+{
+	simAdvance(SIM_IO_NS);
+	v = !!v;
+	if(v && !sim.clk)
+		shiftClock();
+	sim.clk = v;
+}
+
+void simDs(unsigned char v)
+{
+	simAdvance(SIM_IO_NS);
+	sim.ds = !!v;
+}
+
+void simLed(unsigned char v)
+{
+	simAdvance(SIM_IO_NS);
+	v = !!v;
+	if(v != sim.led)
+		++sim.ledChanges;
+	sim.led = v;
+}
+
+// the scan interrupt ORs each sample into the frame after reading it
+static unsigned char sampled(unsigned char v)
+{
+	if(sim.inIsr)
+		simAdvance(SIM_T2_SAMPLE_NS);
+	return v;
+}
+
+unsigned char simStylus()
+{
+	simAdvance(SIM_IO_NS);
+	return sampled(!!(settledOutputs(&sim.settledStylus, sim.settleStylus) & sim.in.stylus));
+}
+
+unsigned char simKeys(int row)
+{
+	simAdvance(SIM_IO_NS);
+	return sampled(!!(settledOutputs(&sim.settledKeys, sim.settleKeys) & sim.in.keys[row]));
+}
+
+unsigned char simMode()
+{
+	// input is pulled up, button connects to ground. The scan
+	// interrupt only reads it at the end of a frame
+	unsigned char v;
+	simAdvance(SIM_IO_NS);
+	v = !sim.in.mode;
+	if(sim.inIsr)
+		simAdvance(SIM_T2_FRAME_NS);
+	return v;
+}
+
+////////////////////////////////////////////////////////////
+//
+// TIMER 2
+//
+////////////////////////////////////////////////////////////
+unsigned char simTmr2()
+{
+	simAdvance(SIM_IO_NS);
+	return (sim.now - (sim.t2Next - T2_PERIOD(sim.pr2))) / SIM_T2_TICK_NS;
+}
+
+void simTmr2Clear()
+{
+	sim.tmr2if = 0;
+	if(sim.inIsr)
+		simAdvance(SIM_T2_START_NS);
+}
+
+////////////////////////////////////////////////////////////
+//
+// TIMER 1
+//
+////////////////////////////////////////////////////////////
+unsigned char simTmr1(int high)
+{
+	unsigned int count;
+	simAdvance(SIM_IO_NS);
+	if(!sim.t1on)
+		return 0;
+	count = ((sim.now - sim.t1Start) / SIM_T1_TICK_NS) & 0xffff;
+	return high? (count >> 8) : (count & 0xff);
+}
+
+void simPr2(unsigned char v)
+{
+	// the timer keeps counting from where it is, so a period
+	// shorter than the current count goes all the way round
+	SIM_TIME start = sim.t2Next - T2_PERIOD(sim.pr2);
+	unsigned int count = (sim.now - start) / SIM_T2_TICK_NS;
+	sim.pr2 = v;
+	sim.t2Next = start + T2_PERIOD(v);
+	if(count > v)
+		sim.t2Next += T2_PERIOD(0xff);
+	simAdvance(SIM_IO_NS);
+	if(sim.inIsr)
+		simAdvance(SIM_T2_STEP_NS);
+}
+
+////////////////////////////////////////////////////////////
+//
+// REGISTER LEVEL SETUP
+//
+////////////////////////////////////////////////////////////
+void init_ports()
+{
+}
+
+void init_usart()
+{
+	sim.cren = 1;
+	sim.rcie = 1;
+	sim.peie = 1;
+	sim.gie = 1;
+}
+
+void init_timer2(unsigned char period)
+{
+	sim.pr2 = period;
+	sim.t2on = 1;
+	sim.t2Next = sim.now + T2_PERIOD(period);
+	sim.tmr2if = 0;
+	sim.tmr2ie = 1;
+}
+
+void init_timer1()
+{
+	sim.t1on = 1;
+	sim.t1Start = sim.now;
+}
+
+void init_spi()
+{
+	sim.sspen = 1;
+	sim.sspif = 0;
+}
+
+void init_timer0()
+{
+	sim.t0on = 1;
+	sim.t0Next = sim.now + SIM_T0_PERIOD_NS;
+	sim.tmr0if = 0;
+	sim.tmr0ie = 1;
+}
+
+////////////////////////////////////////////////////////////
+//
+// USART
+//
+////////////////////////////////////////////////////////////
+void simTxreg(unsigned char c)
+{
+	simAdvance(SIM_IO_NS);
+	if(sim.inIsr)
+		simAdvance(SIM_TX_ISR_NS);
+	if(!sim.tsrBusy)
+		startTsr(c);
+	else if(!sim.txregFull)
+	{
+		sim.txreg = c;
+		sim.txregFull = 1;
+	}
+	else
+	{
+		sim.txreg = c;
+		++sim.txOverwrites;
+	}
+}
+
+unsigned char simTxif()
+{
+	simAdvance(SIM_IO_NS);
+	return !sim.txregFull;
+}
+
+void simTxie(unsigned char v)
+{
+	sim.txie = !!v;
+	simAdvance(SIM_IO_NS);
+}
+
+unsigned char simRcif()
+{
+	simAdvance(SIM_IO_NS);
+	return sim.rcCount > 0;
+}
+
+unsigned char simFerr()
+{
+	simAdvance(SIM_IO_NS);
+	return sim.rcCount && sim.rcFerr[0];
+}
+
+unsigned char simRcreg()
+{
+	unsigned char c;
+	simAdvance(SIM_IO_NS);
+	c = sim.rcFifo[0];
+	if(sim.rcCount)
+	{
+		sim.rcFifo[0] = sim.rcFifo[1];
+		sim.rcFerr[0] = sim.rcFerr[1];
+		--sim.rcCount;
+	}
+	return c;
+}
+
+void simCren(unsigned char v)
+{
+	sim.cren = !!v;
+	if(!v)
+		sim.oerr = 0;
+	simAdvance(SIM_IO_NS);
+}
+
+////////////////////////////////////////////////////////////
+//
+// MSSP
+// Writing SSPBUF starts 8 clocks, MSB first, with the data
+// changing on the falling edge so the shift register takes
+// it on the rising edge. A write during a transfer is lost
+// (WCOL on the real part)
+//
+////////////////////////////////////////////////////////////
+void simSspbuf(unsigned char c)
+{
+	simAdvance(SIM_IO_NS);
+	if(!sim.sspen)
+		return;
+	if(sim.sspBits)
+	{
+		++sim.sspCollisions;
+		return;
+	}
+	sim.sspData = c;
+	sim.sspBits = 8;
+	sim.sspNext = sim.now + SIM_SSP_BIT_NS;
+	++sim.sspBytes;
+}
+
+int simMidiBytes(unsigned char status)
+{
+	int i, count = 0;
+	for(i=0; i<sim.midiLen; ++i)
+		if(!status || sim.midi[i].status == status)
+			count += sim.midi[i].len;
+	return count;
+}
+
+////////////////////////////////////////////////////////////
+//
+// SOURCEBOOST LIBRARY FUNCTIONS
+//
+////////////////////////////////////////////////////////////
+void delay_ms(unsigned char ms)
+{
+	simAdvance(SIM_MS(ms));
+}
+
+void delay_s(unsigned char s)
+{
+	simAdvance(SIM_MS(1000) * s);
+}
+
+unsigned char eeprom_read(unsigned char address)
+{
+	simAdvance(SIM_EEPROM_READ_NS);
+	if(sim.now < sim.eepromDone)
+	{
+		fprintf(stderr, "sim: EEPROM read during a write\n");
+		exit(1);
+	}
+	return sim.eeprom[address];
+}
+
+void eeprom_write(unsigned char address, unsigned char data)
+{
+	while(simEepromBusy())
+		;
+	eeprom_write_start(address, data);
+	while(simEepromBusy())
+		;
+}
+
+////////////////////////////////////////////////////////////
+//
+// DATA EEPROM WRITE CYCLE
+//
+////////////////////////////////////////////////////////////
+void eeprom_write_start(unsigned char address, unsigned char data)
+{
+	simAdvance(SIM_EEPROM_READ_NS);
+	if(sim.now < sim.eepromDone)
+	{
+		fprintf(stderr, "sim: EEPROM write started while busy\n");
+		exit(1);
+	}
+	sim.eeprom[address] = data;
+	sim.eepromDone = sim.now + SIM_EEPROM_WRITE_NS;
+	++sim.eepromWrites;
+}
+
+unsigned char simEepromBusy()
+{
+	simAdvance(SIM_IO_NS);
+	return sim.now < sim.eepromDone;
+}
@@ -0,0 +1,335 @@
+////////////////////////////////////////////////////////////
+//
+// LE STRUM - HOST SIMULATOR
+//
+// Deterministic model of the Le Strum hardware so that
+// StrumController.c can be compiled and run on a Linux
+// workstation. Time is virtual (nanoseconds) and only moves
+// forward when the firmware touches the hardware, so every
+// run of the same input script gives identical results.
+//
+// Modelled:
+// - the two cascaded shift registers, whose store clock is
+//   tied to the shift clock (outputs lag by one clock)
+// - the stylus, touching any set of the 16 strings
+// - the 3x16 chord button matrix and the MODE button
+// - settling of the stylus and chord button lines. After the
+//   outputs change, an input keeps reading as it did for the
+//   old outputs until the new column's settle time has passed,
+//   or the old column's if every output has gone off
+// - the USART at 31250 baud with TXREG and shift register,
+//   and a receiver with its 2 byte FIFO and overrun, fed from
+//   a script of incoming bytes
+// - the data EEPROM, including its write cycle time
+// - the status LED
+// - timer 2 running from Fosc/4 with a 1:4 prescaler
+// - timer 0 running from Fosc/4 with a 1:8 prescaler
+// - timer 1 running free from Fosc/4 with a 1:8 prescaler
+// - the MSSP in SPI master mode at Fosc/4, clocking the shift
+//   register itself when the firmware is built with SCAN_SPI
+// - interrupts, which are dispatched to the firmware's
+//   interrupt() as soon as they are enabled and pending
+//
+////////////////////////////////////////////////////////////
+#ifndef STRUM_SIM_H
+#define STRUM_SIM_H
+
+#include <stdio.h>
+#include <string.h>
+
+typedef unsigned long long SIM_TIME;
+
+// 16 bit unsigned, as an unsigned int is on the PIC, for timer
+// counts that are expected to wrap
+typedef unsigned short word;
+
+#define SIM_US(n)	((SIM_TIME)(n)*1000)
+#define SIM_MS(n)	((SIM_TIME)(n)*1000000)
+
+// Cost model for firmware activity (8MHz clock, 2 MIPS)
+#define SIM_IO_NS			1000			// one pin access (bank select + bit op)
+#define SIM_MIDI_BYTE_NS	320000			// 10 bits at 31250 baud
+#define SIM_EEPROM_READ_NS	4000			// call + register setup
+#define SIM_EEPROM_WRITE_NS	4000000			// self timed write cycle
+#define SIM_ISR_NS			7000			// interrupt entry, context save and exit
+#define SIM_T2_TICK_NS		2000			// timer 2 count, Fosc/4 with 1:4 prescale
+#define SIM_T0_PERIOD_NS	1024000			// timer 0 overflow, 256 counts at Fosc/4 with 1:8 prescale
+#define SIM_T1_TICK_NS		4000			// timer 1 count, Fosc/4 with 1:8 prescale
+#define SIM_SSP_BIT_NS		500				// SPI bit at Fosc/4
+
+// Cost of the interrupt handler's own work, from the cycle count
+// by SCAN_SETTLE_MIN in StrumController.c, less the pin accesses
+// already charged above. Each is charged where that work is done,
+// so that the samples and clock edges land as they do on the PIC
+#define SIM_T2_START_NS		12500			// timer flags and frame pointer, before sampling
+#define SIM_T2_SAMPLE_NS	4000			// putting one sampled input into the frame
+#define SIM_T2_STEP_NS		11000			// period, frame ticks and next step
+#define SIM_T2_FRAME_NS		37500			// frame end after column 15
+#define SIM_TX_ISR_NS		19000			// taking a byte off a MIDI queue
+
+// number of strings / columns on the shift register
+#define SIM_STRINGS		16
+
+// maximum number of scheduled input changes
+#define SIM_MAX_INPUTS		65536
+
+// maximum number of logged MIDI messages
+#define SIM_MAX_MIDI		65536
+
+// maximum number of scheduled bytes at MIDI in
+#define SIM_MAX_MIDI_IN		65536
+
+// longest SysEx message kept, including F0 and F7
+#define SIM_MAX_SYSEX		256
+
+// bytes of SysEx messages logged one after another
+#define SIM_MAX_SYSEX_LOG	65536
+
+// A scheduled change to the physical inputs
+typedef struct {
+	SIM_TIME t;
+	unsigned int stylus;		// bit mask of strings touched by the stylus
+	unsigned int keys[3];		// bit mask of pressed buttons in each row
+	unsigned char mode;			// nonzero when MODE button is held
+	int tag;					// free for the script writer
+} SIM_INPUT;
+
+// A byte arriving at MIDI in
+typedef struct {
+	SIM_TIME t;					// end of its stop bit
+	unsigned char c;
+	unsigned char ferr;			// framing error
+} SIM_MIDI_IN;
+
+// A MIDI message as it appeared on the wire
+typedef struct {
+	SIM_TIME start;				// first bit of first byte
+	SIM_TIME end;				// last bit of last byte
+	unsigned char status;		// status (explicit or running)
+	unsigned char data[2];
+	unsigned char len;			// bytes actually sent, including any status
+} SIM_MIDI;
+
+typedef struct {
+	SIM_TIME now;
+	SIM_TIME limit;				// give up if the firmware is still running past this, 0 for never
+
+	// shift register
+	unsigned char clk;
+	unsigned char ds;
+	unsigned int shift;
+	unsigned int latch;
+	unsigned long clocks;
+
+	// settling
+	SIM_TIME latchTime;					// when the outputs last changed
+	unsigned int settledStylus;			// outputs as last seen by the stylus line
+	unsigned int settledKeys;			// ..and by the chord button lines
+	SIM_TIME settleStylus[SIM_STRINGS];	// settle time when each column comes on
+	SIM_TIME settleKeys[SIM_STRINGS];
+
+	// physical inputs
+	SIM_INPUT in;
+	SIM_INPUT script[SIM_MAX_INPUTS];
+	int scriptLen;
+	int scriptPos;
+
+	// USART
+	unsigned char txregFull;
+	unsigned char txreg;
+	unsigned char tsrBusy;
+	unsigned char tsr;
+	SIM_TIME tsrStart;
+	SIM_TIME tsrDone;
+	unsigned char txie;
+	unsigned long txBytes;
+	unsigned long txOverwrites;	// firmware wrote TXREG while it was full
+	FILE *rawOut;				// when set, every byte on the wire is written here
+
+	// USART receive
+	SIM_MIDI_IN midiIn[SIM_MAX_MIDI_IN];
+	int midiInLen;
+	int midiInPos;
+	unsigned char rcFifo[2];
+	unsigned char rcFerr[2];
+	unsigned char rcCount;
+	unsigned char cren;
+	unsigned char rcie;
+	unsigned char oerr;
+	unsigned long rcBytes;		// bytes received into the FIFO
+	unsigned long rcLost;		// bytes lost to overrun
+
+	// MIDI log (parsed from the wire)
+	SIM_MIDI midi[SIM_MAX_MIDI];
+	int midiLen;
+	unsigned char rxStatus;
+	unsigned char rxData[2];
+	unsigned char rxCount;
+	unsigned char rxStatusSent;
+	SIM_TIME rxStart;
+
+	// last SysEx message (complete when sysexLen is set)
+	unsigned char sysex[SIM_MAX_SYSEX];
+	int sysexLen;
+	int sysexPos;			// bytes of the message in progress, -1 if none
+	unsigned char sysexLog[SIM_MAX_SYSEX_LOG];	// every complete message, in order
+	int sysexLogLen;
+
+	// EEPROM
+	unsigned char eeprom[256];
+	unsigned long eepromWrites;
+	SIM_TIME eepromDone;		// end of the write cycle in progress
+
+	// LED
+	unsigned char led;
+	unsigned long ledChanges;
+
+	// timer 2
+	unsigned char t2on;
+	unsigned char pr2;
+	unsigned char tmr2if;
+	unsigned char tmr2ie;
+	SIM_TIME t2Next;
+
+	// timer 0
+	unsigned char t0on;
+	unsigned char tmr0if;
+	unsigned char tmr0ie;
+	SIM_TIME t0Next;
+
+	// timer 1
+	unsigned char t1on;
+	SIM_TIME t1Start;
+
+	// MSSP (SPI master, shifting out on the shift register lines)
+	unsigned char sspen;
+	unsigned char sspif;		// transfer complete
+	unsigned char sspData;		// bits still to go, MSB first
+	int sspBits;				// bits left in the transfer, 0 if idle
+	SIM_TIME sspNext;			// next rising edge of SCK
+	unsigned long sspBytes;
+	unsigned long sspCollisions;	// firmware wrote SSPBUF during a transfer
+
+	// interrupts
+	unsigned char gie;
+	unsigned char peie;
+	unsigned char inIsr;
+	unsigned long interrupts;
+} SIM;
+
+extern SIM sim;
+
+// simulator control (host/sim.c)
+void simReset(void);
+void simAdvance(SIM_TIME ns);
+void simDefaultSettle(void);
+void simInput(SIM_TIME t, unsigned int stylus, unsigned int keys1, unsigned int keys2, unsigned int keys3, unsigned char mode, int tag);
+int simScriptDone(void);
+int simMidiBytes(unsigned char status);
+SIM_TIME simMidiIn(SIM_TIME t, const unsigned char *bytes, int len);
+SIM_TIME simMidiInError(SIM_TIME t);
+
+// hardware access used by the HAL macros
+void simClk(unsigned char v);
+void simDs(unsigned char v);
+void simLed(unsigned char v);
+unsigned char simStylus(void);
+unsigned char simKeys(int row);
+unsigned char simMode(void);
+unsigned char simTmr2(void);
+void simTmr2Clear(void);
+unsigned char simTmr1(int high);
+void simPr2(unsigned char v);
+void simTxreg(unsigned char c);
+unsigned char simTxif(void);
+void simTxie(unsigned char v);
+unsigned char simRcreg(void);
+unsigned char simRcif(void);
+unsigned char simFerr(void);
+void simCren(unsigned char v);
+void simSspbuf(unsigned char c);
+
+// SourceBoost library functions used by the firmware
+void delay_ms(unsigned char ms);
+void delay_s(unsigned char s);
+unsigned char eeprom_read(unsigned char address);
+void eeprom_write(unsigned char address, unsigned char data);
+void eeprom_write_start(unsigned char address, unsigned char data);
+unsigned char simEepromBusy(void);
+
+// register level setup, which has no meaning on the host
+void init_ports(void);
+void init_usart(void);
+void init_timer2(unsigned char period);
+void init_timer0(void);
+void init_timer1(void);
+void init_spi(void);
+
+// firmware entry points (StrumController.c)
+void startup(void);
+void pollIO(void);
+void interrupt(void);
+
+////////////////////////////////////////////////////////////
+// HAL MAPPING
+////////////////////////////////////////////////////////////
+
+// Shift register outputs
+#define HAL_CLK(v)		simClk(v)
+#define HAL_DS(v)		simDs(v)
+#define HAL_LED(v)		simLed(v)
+
+// Inputs
+#define HAL_STYLUS		simStylus()
+#define HAL_KEYS1		simKeys(0)
+#define HAL_KEYS2		simKeys(1)
+#define HAL_KEYS3		simKeys(2)
+#define HAL_MODE		simMode()
+
+// USART transmit
+#define HAL_TXREG(c)	simTxreg(c)
+#define HAL_TXIF		simTxif()
+#define HAL_TXIE_ON		sim.txie
+#define HAL_TXIE(v)		simTxie(v)
+
+// USART receive
+#define HAL_RCREG		simRcreg()
+#define HAL_RCIF		simRcif()
+#define HAL_FERR		simFerr()
+#define HAL_OERR		sim.oerr
+#define HAL_CREN(v)		simCren(v)
+
+// Timer 2 (string scan)
+#define HAL_TMR2IF			sim.tmr2if
+#define HAL_TMR2IF_CLEAR()	simTmr2Clear()
+#define HAL_TMR2IE_ON		sim.tmr2ie
+#define HAL_TMR2IE(v)		sim.tmr2ie = (v)
+#define HAL_TMR2			simTmr2()
+#define HAL_PR2(v)			simPr2(v)
+
+// Timer 0 (system tick)
+#define HAL_TMR0IF			sim.tmr0if
+#define HAL_TMR0IF_CLEAR()	sim.tmr0if = 0
+
+// Timer 1 (timestamps)
+#define HAL_TMR1H			simTmr1(1)
+#define HAL_TMR1L			simTmr1(0)
+
+// MSSP (shift register clock and data with SCAN_SPI)
+#define HAL_SSPBUF(c)		simSspbuf(c)
+#define HAL_SSPIF			sim.sspif
+#define HAL_SSPIF_CLEAR()	sim.sspif = 0
+
+// Data EEPROM write in progress
+#define HAL_EEPROM_BUSY		simEepromBusy()
+
+// Global interrupt enable
+#define HAL_GIE(v)			sim.gie = (v)
+
+// SourceBoost program memory data
+#define rom				const
+
+// Called while waiting for an interrupt to do some work
+#define HAL_IDLE()		simAdvance(SIM_IO_NS)
+
+#endif // STRUM_SIM_H
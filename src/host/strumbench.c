@@ -0,0 +1,323 @@
+////////////////////////////////////////////////////////////
+//
+// LE STRUM - HOST BENCHMARK
+//
+// Runs the chord hot paths for every root, chord type and
+// extension under every preset patch and reports the cost
+// and MIDI bytes per call.
+//
+// Cost is counted in basic blocks: the firmware is built at
+// -O0 with -fsanitize-coverage=trace-pc, which calls back on
+// every block entered. Unlike host time this is exactly the
+// same on every run and every machine, and it follows the
+// source closely enough to show whether a change makes the
+// PIC do more or less work. Host time per call is shown in
+// the comparison but is neither saved nor checked.
+//
+// usage: strumbench > bench.baseline
+//        strumbench -c bench.baseline [-t percent]
+//
+// With -c the results are compared against a saved baseline
+// and the exit status is 1 if blocks or bytes per call have
+// gone up by more than the threshold (default 2%)
+//
+////////////////////////////////////////////////////////////
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "sim.h"
+
+typedef unsigned char byte;
+
+// these must match StrumController.c
+#define OPT_SUSTAINCOMMON	0x0200
+#define OPT_DIATONIC		0x4000
+#define OPT_PENTATONIC		0x8000
+enum { CHORD_MAJ = 0b001, CHORD_MIN = 0b010, CHORD_DOM7 = 0b100, CHORD_MAJ7 = 0b101, CHORD_MIN7 = 0b110, CHORD_AUG = 0b111, CHORD_DIM = 0b011 };
+typedef struct
+{
+	byte chordType;
+	byte rootNote;
+	byte extension;
+} CHORD_SELECTION;
+typedef struct {
+	byte bits[16];
+} NOTESET;
+
+// the firmware under test
+extern unsigned int options;
+extern byte playChannel;
+extern NOTESET playSounding;
+extern const unsigned int patch_BasicStrum;
+extern const unsigned int patch_GuitarStrum;
+extern const unsigned int patch_GuitarSustain;
+extern const unsigned int patch_OrganButtons;
+extern const unsigned int patch_OrganButtonsAddedNotes;
+extern const unsigned int patch_OrganButtonsAddedNotesRetrig;
+extern const unsigned int patch_OrganButtonsChromatic;
+void changeToChord(CHORD_SELECTION *pChordSelection);
+byte stackTriads(CHORD_SELECTION *pChordSelection, byte maxReps, byte transpose, byte size, byte *chord, unsigned int keys);
+byte guitarChord(CHORD_SELECTION *pChordSelection, byte transpose, byte *chord);
+byte makeScale(byte root, byte transpose, unsigned int mask, byte *chord);
+void playChordNotes(NOTESET *oldNotes, NOTESET *newNotes, NOTESET *sounding, byte channel, byte velocity, byte sustainCommon);
+void calculateChord(CHORD_SELECTION *pChordSelection, byte *notes, NOTESET *drone);
+void noteSetFromNotes(NOTESET *set, byte *notes);
+byte txPending(void);
+
+static const struct {
+	const char *name;
+	const unsigned int *options;
+} patches[] = {
+	{ "basic", &patch_BasicStrum },
+	{ "guitar", &patch_GuitarStrum },
+	{ "guitarsus", &patch_GuitarSustain },
+	{ "organ", &patch_OrganButtons },
+	{ "organadd", &patch_OrganButtonsAddedNotes },
+	{ "organretrig", &patch_OrganButtonsAddedNotesRetrig },
+	{ "chromatic", &patch_OrganButtonsChromatic },
+	{ NULL, NULL }
+};
+
+static const byte chordTypes[] = { CHORD_MAJ, CHORD_MIN, CHORD_DOM7, CHORD_MAJ7, CHORD_MIN7, CHORD_AUG, CHORD_DIM };
+#define CHORD_TYPES (sizeof(chordTypes)/sizeof(chordTypes[0]))
+#define ROOTS 12
+#define EXTENSIONS 8
+
+////////////////////////////////////////////////////////////
+// Basic block counter, called from the instrumented firmware
+static unsigned long long blocks = 0;
+void __sanitizer_cov_trace_pc(void)
+{
+	++blocks;
+}
+
+////////////////////////////////////////////////////////////
+// Results for one function under one patch
+typedef struct {
+	const char *function;
+	const char *patch;
+	unsigned long calls;
+	unsigned long long blocks;
+	unsigned long blocksMax;
+	unsigned long long bytes;
+	double ns;
+} RESULT;
+
+#define MAX_RESULTS 64
+static RESULT results[MAX_RESULTS];
+static int resultCount = 0;
+
+static RESULT *newResult(const char *function, const char *patch)
+{
+	RESULT *r = &results[resultCount++];
+	memset(r, 0, sizeof(*r));
+	r->function = function;
+	r->patch = patch;
+	return r;
+}
+
+static double hostNs()
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+// Let the USART send everything the firmware has queued
+static void drain()
+{
+	while(txPending() || sim.txregFull || sim.tsrBusy)
+		simAdvance(SIM_US(10));
+}
+
+// Time one call. The TX buffer is drained first so that each
+// call starts from the same place, and afterwards to count
+// the bytes it sent
+#define MEASURE(r, call) do { \
+		unsigned long long b0; \
+		unsigned long txBytes0; \
+		double t0; \
+		drain(); \
+		txBytes0 = sim.txBytes; \
+		b0 = blocks; \
+		t0 = hostNs(); \
+		call; \
+		(r)->ns += hostNs() - t0; \
+		b0 = blocks - b0; \
+		(r)->blocks += b0; \
+		if(b0 > (r)->blocksMax) \
+			(r)->blocksMax = b0; \
+		drain(); \
+		(r)->bytes += sim.txBytes - txBytes0; \
+		++(r)->calls; \
+	} while(0)
+
+////////////////////////////////////////////////////////////
+// Start the firmware from power on with a patch selected.
+// Only the USART interrupt is left on, so that send() can
+// make room in the buffer
+static void powerOn(unsigned int patch)
+{
+	simReset();
+	startup();
+	options = patch;
+	sim.tmr2ie = 0;
+	sim.tmr0ie = 0;
+}
+
+// The scale mask calculateChord would use, bit n for the note
+// n semitones above the root
+static unsigned int scaleMask(CHORD_SELECTION *sel)
+{
+	if(options & OPT_DIATONIC)
+		return (sel->chordType == CHORD_MIN || sel->chordType == CHORD_MIN7)? 0x05ad : 0x0ab5;
+	if(options & OPT_PENTATONIC)
+		return 0x0295;
+	return 0x0fff;
+}
+
+////////////////////////////////////////////////////////////
+// Run every function for every chord under one patch
+static void benchPatch(const char *patch, unsigned int patchOptions)
+{
+	RESULT *rChange, *rStack, *rGuitar, *rScale, *rPlay;
+	CHORD_SELECTION sel;
+	byte chord[16];
+	byte notes[16];
+	NOTESET oldNotes, newNotes, drone;
+	int root, type, ext;
+
+	// changeToChord, from one chord straight to the next as
+	// a player would, so it sees the cache as it would be
+	powerOn(patchOptions);
+	rChange = newResult("changeToChord", patch);
+	for(root=0; root<ROOTS; ++root)
+		for(type=0; type<(int)CHORD_TYPES; ++type)
+			for(ext=0; ext<EXTENSIONS; ++ext)
+			{
+				sel.chordType = chordTypes[type];
+				sel.rootNote = root;
+				sel.extension = ext;
+				MEASURE(rChange, changeToChord(&sel));
+			}
+
+	// the chord building functions on their own
+	powerOn(patchOptions);
+	rStack = newResult("stackTriads", patch);
+	rGuitar = newResult("guitarChord", patch);
+	rScale = newResult("makeScale", patch);
+	for(root=0; root<ROOTS; ++root)
+		for(type=0; type<(int)CHORD_TYPES; ++type)
+			for(ext=0; ext<EXTENSIONS; ++ext)
+			{
+				sel.chordType = chordTypes[type];
+				sel.rootNote = root;
+				sel.extension = ext;
+				MEASURE(rStack, stackTriads(&sel, -1, 36, 16, chord, 0));
+				MEASURE(rGuitar, guitarChord(&sel, 12, chord));
+				MEASURE(rScale, makeScale(root, 48, scaleMask(&sel), chord));
+			}
+
+	// playChordNotes from each chord's notes to the next
+	powerOn(patchOptions);
+	rPlay = newResult("playChordNotes", patch);
+	memset(&oldNotes, 0, sizeof(oldNotes));
+	for(root=0; root<ROOTS; ++root)
+		for(type=0; type<(int)CHORD_TYPES; ++type)
+			for(ext=0; ext<EXTENSIONS; ++ext)
+			{
+				sel.chordType = chordTypes[type];
+				sel.rootNote = root;
+				sel.extension = ext;
+				calculateChord(&sel, notes, &drone);
+				noteSetFromNotes(&newNotes, notes);
+				MEASURE(rPlay, playChordNotes(&oldNotes, &newNotes, &playSounding, playChannel, 127, !!(options & OPT_SUSTAINCOMMON)));
+			}
+}
+
+////////////////////////////////////////////////////////////
+// Compare against a baseline. Returns the number of results
+// that have got worse by more than the threshold
+static int compare(const char *path, double threshold)
+{
+	FILE *f = fopen(path, "r");
+	char line[256], function[64], patch[64];
+	double blocksPer, bytesPer;
+	int i, found, worse = 0;
+
+	if(!f)
+	{
+		perror(path);
+		return -1;
+	}
+	printf("%-16s %-12s %10s %10s %7s   %8s %8s %7s   %8s\n", "function", "patch", "blocks", "baseline", "change", "bytes", "baseline", "change", "host ns");
+	while(fgets(line, sizeof(line), f))
+	{
+		if(line[0] == '#' || sscanf(line, "%63s %63s %*u %lf %*u %lf", function, patch, &blocksPer, &bytesPer) != 4)
+			continue;
+		found = 0;
+		for(i=0; i<resultCount; ++i)
+		{
+			RESULT *r = &results[i];
+			double b, m, db, dm;
+			int bad;
+			if(strcmp(r->function, function) || strcmp(r->patch, patch))
+				continue;
+			found = 1;
+			b = (double)r->blocks / r->calls;
+			m = (double)r->bytes / r->calls;
+			db = blocksPer? 100.0 * (b - blocksPer) / blocksPer : 0;
+			dm = bytesPer? 100.0 * (m - bytesPer) / bytesPer : (m? 100.0 : 0);
+			bad = (db > threshold) || (dm > threshold);
+			printf("%-16s %-12s %10.1f %10.1f %+6.1f%%   %8.2f %8.2f %+6.1f%%   %8.0f %s\n", function, patch, b, blocksPer, db, m, bytesPer, dm, r->ns / r->calls, bad? "WORSE" : "");
+			worse += bad;
+		}
+		if(!found)
+			printf("%-16s %-12s missing from this build\n", function, patch);
+	}
+	fclose(f);
+	return worse;
+}
+
+////////////////////////////////////////////////////////////
+int main(int argc, char *argv[])
+{
+	const char *baseline = NULL;
+	double threshold = 2.0;
+	int i, worse;
+
+	for(i=1; i<argc; ++i)
+	{
+		if(!strcmp(argv[i], "-c") && i+1 < argc)
+			baseline = argv[++i];
+		else if(!strcmp(argv[i], "-t") && i+1 < argc)
+			threshold = atof(argv[++i]);
+		else
+		{
+			fprintf(stderr, "usage: strumbench [-c baseline] [-t percent]\n");
+			return 1;
+		}
+	}
+
+	for(i=0; patches[i].name; ++i)
+		benchPatch(patches[i].name, *patches[i].options);
+
+	if(baseline)
+	{
+		worse = compare(baseline, threshold);
+		if(worse < 0)
+			return 1;
+		printf("%d of %d results more than %.1f%% worse than %s\n", worse, resultCount, threshold, baseline);
+		return worse? 1 : 0;
+	}
+
+	printf("# function       patch        calls blocks/call   max bytes/call\n");
+	for(i=0; i<resultCount; ++i)
+	{
+		RESULT *r = &results[i];
+		printf("%-16s %-12s %5lu %10.1f %6lu %8.2f\n", r->function, r->patch, r->calls,
+			(double)r->blocks / r->calls, r->blocksMax, (double)r->bytes / r->calls);
+	}
+	return 0;
+}
@@ -0,0 +1,358 @@
+////////////////////////////////////////////////////////////
+//
+// LE STRUM - SCAN TRACE REPLAY
+//
+// Plays a recorded scan trace into the firmware on the
+// simulated hardware and writes out the MIDI it produces,
+// with virtual time stamps, and a summary of throughput and
+// latency. Traces of real performances make better workloads
+// than scripted strums.
+//
+// usage: strumreplay [-p patch] [-o midi.txt] [-w out.trace] [-v] trace
+//
+// The trace is either a text trace (below) or a raw MIDI
+// capture from a SCAN_TRACE build of the firmware, such as
+// "amidi -p hw:1 -r capture.syx". A capture is recognised by
+// its first byte having the top bit set. -w writes what was
+// read as a text trace, for converting captures.
+//
+// Text trace format, one scan frame per line:
+//
+//   # comment
+//   patch guitarsus
+//   <time us> <stylus> <keys1> <keys2> <keys3> <mode>
+//
+// Time is from the start of the trace. stylus and keys are
+// 4 hex digits with bit 0 for the first string or column and
+// a 1 where the stylus touches or a button is held. mode is
+// 1 while MODE is held. Lines need only be written when the
+// inputs change. "patch" selects a preset before the replay
+// (-p overrides it)
+//
+////////////////////////////////////////////////////////////
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "sim.h"
+
+// firmware state we look at
+extern unsigned int options;
+extern unsigned int txOverflows;
+extern unsigned char txHighWater;
+extern const unsigned int patch_BasicStrum;
+extern const unsigned int patch_GuitarStrum;
+extern const unsigned int patch_GuitarSustain;
+extern const unsigned int patch_OrganButtons;
+extern const unsigned int patch_OrganButtonsAddedNotes;
+extern const unsigned int patch_OrganButtonsAddedNotesRetrig;
+extern const unsigned int patch_OrganButtonsChromatic;
+
+static const struct {
+	const char *name;
+	const unsigned int *options;
+} patches[] = {
+	{ "basic", &patch_BasicStrum },
+	{ "guitar", &patch_GuitarStrum },
+	{ "guitarsus", &patch_GuitarSustain },
+	{ "organ", &patch_OrganButtons },
+	{ "organadd", &patch_OrganButtonsAddedNotes },
+	{ "organretrig", &patch_OrganButtonsAddedNotesRetrig },
+	{ "chromatic", &patch_OrganButtonsChromatic },
+	{ NULL, NULL }
+};
+
+// SysEx header of a SCAN_TRACE frame, and its whole length
+static const unsigned char traceHeader[] = { 0xf0, 0x7d, 0x4c, 0x53, 0x02 };
+#define TRACE_SYSEX_LEN 22
+
+// Timer 1 count in a SCAN_TRACE stamp
+#define TRACE_TICK_US 4
+
+typedef struct {
+	unsigned long long t;		// us from the start of the trace
+	unsigned int stylus;
+	unsigned int keys[3];
+	unsigned char mode;
+} FRAME;
+
+static FRAME *frames = NULL;
+static int frameCount = 0;
+static int frameMax = 0;
+static char tracePatch[64] = "";
+
+static void addFrame(FRAME *f)
+{
+	if(frameCount == frameMax)
+	{
+		frameMax = frameMax? frameMax * 2 : 1024;
+		frames = realloc(frames, frameMax * sizeof(FRAME));
+		if(!frames)
+		{
+			fprintf(stderr, "out of memory\n");
+			exit(1);
+		}
+	}
+	frames[frameCount++] = *f;
+}
+
+////////////////////////////////////////////////////////////
+// Read a text trace
+static int loadText(FILE *in, const char *path)
+{
+	char line[256];
+	int n = 0;
+	while(fgets(line, sizeof(line), in))
+	{
+		FRAME f;
+		unsigned int mode;
+		++n;
+		if(line[0] == '#' || line[strspn(line, " \t\r\n")] == 0)
+			continue;
+		if(sscanf(line, "patch %63s", tracePatch) == 1)
+			continue;
+		if(sscanf(line, "%llu %x %x %x %x %u", &f.t, &f.stylus, &f.keys[0], &f.keys[1], &f.keys[2], &mode) != 6)
+		{
+			fprintf(stderr, "%s:%d: bad trace line\n", path, n);
+			return 0;
+		}
+		if(frameCount && f.t < frames[frameCount-1].t)
+		{
+			fprintf(stderr, "%s:%d: time goes backwards\n", path, n);
+			return 0;
+		}
+		f.mode = !!mode;
+		addFrame(&f);
+	}
+	return 1;
+}
+
+////////////////////////////////////////////////////////////
+// Read a raw MIDI capture, picking out the SCAN_TRACE SysEx
+// frames from everything else the firmware sent
+static unsigned int word7(unsigned char *p)
+{
+	return p[0] | (p[1] << 7) | ((p[2] & 0x03) << 14);
+}
+
+static int loadCapture(FILE *in)
+{
+	unsigned char msg[TRACE_SYSEX_LEN];
+	unsigned int lastStamp = 0;
+	int len = -1, c;
+	FRAME f;
+
+	memset(&f, 0, sizeof(f));
+	while((c = fgetc(in)) != EOF)
+	{
+		if(c >= 0xf8)
+			continue;	// realtime can come in the middle of SysEx
+		if(c == 0xf0)
+			len = 0;
+		else if(c & 0x80 && c != 0xf7)
+			len = -1;
+		if(len < 0)
+			continue;
+		if(len < TRACE_SYSEX_LEN)
+			msg[len] = c;
+		++len;
+		if(c != 0xf7)
+			continue;
+		if(len == TRACE_SYSEX_LEN && !memcmp(msg, traceHeader, sizeof(traceHeader)))
+		{
+			unsigned int stamp = word7(&msg[5]);
+			if(frameCount)
+				f.t += ((stamp - lastStamp) & 0xffff) * TRACE_TICK_US;
+			lastStamp = stamp;
+			f.stylus = word7(&msg[8]);
+			f.keys[0] = word7(&msg[11]);
+			f.keys[1] = word7(&msg[14]);
+			f.keys[2] = word7(&msg[17]);
+			f.mode = msg[20];
+			addFrame(&f);
+		}
+		len = -1;
+	}
+	return 1;
+}
+
+static int saveText(const char *path)
+{
+	FILE *out = fopen(path, "w");
+	int i;
+	if(!out)
+	{
+		perror(path);
+		return 0;
+	}
+	fprintf(out, "# le strum scan trace\n");
+	fprintf(out, "# time_us stylus keys1 keys2 keys3 mode\n");
+	if(tracePatch[0])
+		fprintf(out, "patch %s\n", tracePatch);
+	for(i=0; i<frameCount; ++i)
+	{
+		FRAME *f = &frames[i];
+		fprintf(out, "%llu %04x %04x %04x %04x %d\n", f->t, f->stylus, f->keys[0], f->keys[1], f->keys[2], f->mode);
+	}
+	fclose(out);
+	return 1;
+}
+
+////////////////////////////////////////////////////////////
+// Write out the MIDI bytes as they went on the wire, one
+// message per line
+static int saveMidi(const char *path, SIM_TIME start)
+{
+	FILE *out = fopen(path, "w");
+	int i, j, n;
+	if(!out)
+	{
+		perror(path);
+		return 0;
+	}
+	fprintf(out, "# time_ms bytes\n");
+	for(i=0; i<sim.midiLen; ++i)
+	{
+		SIM_MIDI *p = &sim.midi[i];
+		n = (p->status >= 0xf0)? 0 : ((p->status & 0xe0) == 0xc0)? 1 : 2;
+		fprintf(out, "%.3f", (p->start - start)/1e6);
+		if(p->len > n)
+			fprintf(out, " %02x", p->status);
+		for(j=0; j<n; ++j)
+			fprintf(out, " %02x", p->data[j]);
+		fprintf(out, "\n");
+	}
+	fclose(out);
+	return 1;
+}
+
+////////////////////////////////////////////////////////////
+int main(int argc, char *argv[])
+{
+	const char *trace = NULL;
+	const char *patch = NULL;
+	const char *midiOut = NULL;
+	const char *traceOut = NULL;
+	int verbose = 0, usage = 0;
+	int i, j, c, first = 0, changes = 0, found = 0;
+	SIM_TIME start, end, longestPoll = 0;
+	SIM_TIME lat, latMin = ~0ULL, latMax = 0, latSum = 0;
+	FILE *in;
+
+	for(i=1; i<argc; ++i)
+	{
+		if(!strcmp(argv[i], "-p") && i+1 < argc)
+			patch = argv[++i];
+		else if(!strcmp(argv[i], "-o") && i+1 < argc)
+			midiOut = argv[++i];
+		else if(!strcmp(argv[i], "-w") && i+1 < argc)
+			traceOut = argv[++i];
+		else if(!strcmp(argv[i], "-v"))
+			verbose = 1;
+		else if(argv[i][0] != '-' && !trace)
+			trace = argv[i];
+		else
+			usage = 1;
+	}
+	if(usage || !trace)
+	{
+		fprintf(stderr, "usage: strumreplay [-p patch] [-o midi.txt] [-w out.trace] [-v] trace\n");
+		return 1;
+	}
+
+	// read the trace
+	if(!(in = fopen(trace, "rb")))
+	{
+		perror(trace);
+		return 1;
+	}
+	c = fgetc(in);
+	ungetc(c, in);
+	if(!((c != EOF && (c & 0x80))? loadCapture(in) : loadText(in, trace)))
+		return 1;
+	fclose(in);
+	if(!frameCount)
+	{
+		fprintf(stderr, "%s: no scan frames\n", trace);
+		return 1;
+	}
+	if(patch)
+		snprintf(tracePatch, sizeof(tracePatch), "%s", patch);
+	if(traceOut && !saveText(traceOut))
+		return 1;
+
+	// power on, select the patch and script the inputs
+	simReset();
+	startup();
+	if(tracePatch[0])
+	{
+		for(i=0; patches[i].name; ++i)
+			if(!strcmp(patches[i].name, tracePatch))
+				break;
+		if(!patches[i].name)
+		{
+			fprintf(stderr, "unknown patch %s\n", tracePatch);
+			return 1;
+		}
+		options = *patches[i].options;
+	}
+	start = sim.now + SIM_MS(50);
+	for(i=0; i<frameCount; ++i)
+	{
+		FRAME *f = &frames[i];
+		FRAME *p = i? &frames[i-1] : NULL;
+		if(p && f->stylus == p->stylus && f->mode == p->mode && !memcmp(f->keys, p->keys, sizeof(f->keys)))
+			continue;
+		simInput(start + SIM_US(f->t), f->stylus, f->keys[0], f->keys[1], f->keys[2], f->mode, i);
+		++changes;
+	}
+	end = start + SIM_US(frames[frameCount-1].t) + SIM_MS(500);
+
+	// replay
+	while(sim.now < end)
+	{
+		SIM_TIME t = sim.now;
+		pollIO();
+		if(sim.now - t > longestPoll)
+			longestPoll = sim.now - t;
+	}
+
+	// time from each stylus change to the first note on after it
+	for(i=0; i<sim.scriptLen; ++i)
+	{
+		SIM_INPUT *in = &sim.script[i];
+		while(first < sim.midiLen && sim.midi[first].start < in->t)
+			++first;
+		if(i && in->stylus == sim.script[i-1].stylus)
+			continue;
+		for(j=first; j<sim.midiLen; ++j)
+		{
+			SIM_MIDI *p = &sim.midi[j];
+			if((p->status & 0xf0) != 0x90 || !p->data[1])
+				continue;
+			if(i+1 < sim.scriptLen && p->start > sim.script[i+1].t + SIM_MS(50))
+				break;
+			lat = p->start - in->t;
+			if(lat < latMin) latMin = lat;
+			if(lat > latMax) latMax = lat;
+			latSum += lat;
+			++found;
+			break;
+		}
+	}
+
+	printf("replay: %s, %d frames, %d input changes over %.3fs\n", trace, frameCount, changes, frames[frameCount-1].t/1e6);
+	printf("  patch            %s\n", tracePatch[0]? tracePatch : "default");
+	printf("  longest pollIO   %.3fms\n", longestPoll/1e6);
+	printf("  MIDI messages    %d\n", sim.midiLen);
+	printf("  MIDI bytes       %lu (%.1f per input change)\n", sim.txBytes, (double)sim.txBytes / changes);
+	if(found)
+		printf("  latency          min %.3fms avg %.3fms max %.3fms (%d stylus changes)\n", latMin/1e6, latSum/1e6/found, latMax/1e6, found);
+	printf("  TX buffer        high water %d bytes, %u overflows\n", txHighWater, txOverflows);
+
+	if(midiOut && !saveMidi(midiOut, start))
+		return 1;
+	if(verbose)
+		for(i=0; i<sim.midiLen; ++i)
+			printf("%10.3fms %02x %3d %3d (%d bytes)\n", (sim.midi[i].start - start)/1e6, sim.midi[i].status, sim.midi[i].data[0], sim.midi[i].data[1], sim.midi[i].len);
+	return 0;
+}
@@ -0,0 +1,1348 @@
+////////////////////////////////////////////////////////////
+//
+// LE STRUM - HOST SIMULATION RUNNER
+//
+// Runs the firmware against scripted playing on the
+// simulated hardware and reports scan rate, MIDI bytes
+// per event and latency, all in virtual time.
+//
+// usage: strumsim [strum|chords|calibrate|settings|scales|presets|panic|channels|dynamics|stats|thru|cutoff|arp|perform|burst|glitch] [-p patch] [-s us] [-r raw] [-v]
+//
+////////////////////////////////////////////////////////////
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "sim.h"
+
+// firmware state we look at
+extern unsigned int options;
+extern unsigned int settings;
+extern struct {
+	unsigned char notes[16];	// must match STRING_STATE in StrumController.c
+} playStrings;
+extern unsigned char playChannel;
+extern unsigned char droneChannel;
+extern unsigned char playVelocity;
+extern unsigned char droneOctave;
+extern unsigned int txOverflows;
+extern unsigned char txHighWater;
+extern unsigned int scansPerSecond;
+extern unsigned int scanOverruns;
+extern unsigned char stringSettle[16];
+extern unsigned char keySettle[16];
+extern unsigned int chordCacheHits;
+extern unsigned int chordCacheMisses;
+extern unsigned char eventOverflows;
+extern const unsigned int patch_BasicStrum;
+extern const unsigned int patch_GuitarStrum;
+extern const unsigned int patch_GuitarSustain;
+extern const unsigned int patch_OrganButtons;
+extern const unsigned int patch_OrganButtonsAddedNotes;
+extern const unsigned int patch_OrganButtonsAddedNotesRetrig;
+extern const unsigned int patch_OrganButtonsChromatic;
+void setPlayChannel(unsigned char c);
+void setDroneChannel(unsigned char c);
+void storePreset(unsigned char slot);
+void recallPreset(unsigned char slot);
+
+// tags attached to scripted inputs
+#define TAG_NONE		-1
+#define TAG_BREAK		0		// + string, stylus leaves a string
+#define TAG_MAKE		100		// + string, stylus touches a string
+#define TAG_CHORD		200		// + chord index, chord buttons change
+
+// chord button positions (row masks for a root column)
+#define ROW_MAJ		0
+#define ROW_MIN		1
+#define ROW_DOM7	2
+
+static const struct {
+	const char *name;
+	const unsigned int *options;
+} patches[] = {
+	{ "basic", &patch_BasicStrum },
+	{ "guitar", &patch_GuitarStrum },
+	{ "guitarsus", &patch_GuitarSustain },
+	{ "organ", &patch_OrganButtons },
+	{ "organadd", &patch_OrganButtonsAddedNotes },
+	{ "organretrig", &patch_OrganButtonsAddedNotesRetrig },
+	{ "chromatic", &patch_OrganButtonsChromatic },
+	{ NULL, NULL }
+};
+
+// a simple chord progression: root column and row
+static const struct {
+	int column;
+	int row;
+} progression[] = {
+	{ 0, ROW_MAJ },		// C
+	{ 9, ROW_MIN },		// Am
+	{ 5, ROW_MAJ },		// F
+	{ 7, ROW_DOM7 },	// G7
+};
+#define PROGRESSION_LEN (sizeof(progression)/sizeof(progression[0]))
+
+static int verbose = 0;
+static SIM_TIME longestPoll = 0;
+
+////////////////////////////////////////////////////////////
+// Run the firmware main loop until the given virtual time
+static void runUntil(SIM_TIME t)
+{
+	while(sim.now < t)
+	{
+		SIM_TIME start = sim.now;
+		pollIO();
+		if(sim.now - start > longestPoll)
+			longestPoll = sim.now - start;
+	}
+}
+
+////////////////////////////////////////////////////////////
+// Find the first note on for a note that started at or
+// after a given time
+static SIM_MIDI *findNoteOn(SIM_TIME after, unsigned char note)
+{
+	int i;
+	for(i=0; i<sim.midiLen; ++i)
+	{
+		SIM_MIDI *p = &sim.midi[i];
+		if(p->start >= after && (p->status & 0xf0) == 0x90 && p->data[0] == note && p->data[1])
+			return p;
+	}
+	return NULL;
+}
+
+static void dumpMidi()
+{
+	int i;
+	for(i=0; i<sim.midiLen; ++i)
+	{
+		SIM_MIDI *p = &sim.midi[i];
+		printf("%10.3fms %02x %3d %3d (%d bytes)\n", p->start/1e6, p->status, p->data[0], p->data[1], p->len);
+	}
+}
+
+////////////////////////////////////////////////////////////
+// STRUM SCENARIO
+// Hold a C major chord and strum down and up across all
+// strings with a fixed time per string
+static void scenarioStrum(SIM_TIME perString, int strums)
+{
+	SIM_TIME t, start;
+	int i, s, n;
+	int expected = 0, found = 0;
+	SIM_TIME lat, latMin = ~0ULL, latMax = 0, latSum = 0;
+	unsigned long bytes0;
+
+	t = sim.now + SIM_MS(50);
+	simInput(t, 0, 1, 0, 0, 0, TAG_CHORD);
+	t += SIM_MS(100);
+	start = t;
+	for(n=0; n<strums; ++n)
+	{
+		for(i=0; i<16; ++i)
+		{
+			s = (n&1)? (15-i) : i;
+			simInput(t, 1<<s, 1, 0, 0, 0, TAG_MAKE + s);
+			t += perString/2;
+			simInput(t, 0, 1, 0, 0, 0, TAG_BREAK + s);
+			t += perString/2;
+		}
+		t += SIM_MS(200);
+	}
+
+	runUntil(start);
+	bytes0 = sim.txBytes;
+	runUntil(t);
+
+	// latency from the stylus leaving each string to the
+	// complete note on message being received
+	for(i=0; i<sim.scriptLen; ++i)
+	{
+		SIM_INPUT *p = &sim.script[i];
+		SIM_MIDI *m;
+		if(p->tag < TAG_BREAK || p->tag >= TAG_MAKE)
+			continue;
+		if(playStrings.notes[p->tag] == 0xff)
+			continue;
+		++expected;
+		m = findNoteOn(p->t, playStrings.notes[p->tag]);
+		if(!m || m->start > p->t + SIM_MS(50))
+			continue;
+		++found;
+		lat = m->end - p->t;
+		latSum += lat;
+		if(lat < latMin) latMin = lat;
+		if(lat > latMax) latMax = lat;
+	}
+
+	printf("strum: %d strums at %.3fms per string\n", strums, perString/1e6);
+	printf("  scan rate        %u scans/s, %u overruns\n", scansPerSecond, scanOverruns);
+	printf("  longest pollIO   %.3fms\n", longestPoll/1e6);
+	printf("  note ons         %d of %d string releases\n", found, expected);
+	printf("  MIDI bytes       %lu (%.2f per string event)\n", sim.txBytes - bytes0, (double)(sim.txBytes - bytes0) / (strums * 16));
+	if(found)
+		printf("  latency          min %.3fms avg %.3fms max %.3fms\n", latMin/1e6, latSum/1e6/found, latMax/1e6);
+}
+
+////////////////////////////////////////////////////////////
+// CHORD SCENARIO
+// Cycle through a chord progression and measure the MIDI
+// traffic and time taken by each chord change
+static void scenarioChords(SIM_TIME hold, int cycles)
+{
+	SIM_TIME t, start;
+	int i, n, changes = 0;
+	unsigned int keys[3];
+	SIM_TIME busy, busyMax = 0, busySum = 0;
+
+	t = sim.now + SIM_MS(50);
+	start = t;
+	for(n=0; n<cycles; ++n)
+	{
+		for(i=0; i<(int)PROGRESSION_LEN; ++i)
+		{
+			memset(keys, 0, sizeof(keys));
+			keys[progression[i].row] = 1<<progression[i].column;
+			simInput(t, 0, keys[0], keys[1], keys[2], 0, TAG_CHORD + i);
+			t += hold;
+			++changes;
+		}
+	}
+	simInput(t, 0, 0, 0, 0, 0, TAG_CHORD);
+	t += hold;
+	runUntil(t);
+
+	// time from each chord change until the MIDI burst it
+	// caused has been fully transmitted
+	for(i=0; i<sim.scriptLen; ++i)
+	{
+		SIM_TIME from = sim.script[i].t;
+		SIM_TIME to = (i+1 < sim.scriptLen)? sim.script[i+1].t : t;
+		SIM_TIME last = from;
+		int j;
+		if(from < start)
+			continue;
+		for(j=0; j<sim.midiLen; ++j)
+			if(sim.midi[j].start >= from && sim.midi[j].start < to)
+				last = sim.midi[j].end;
+		busy = last - from;
+		busySum += busy;
+		if(busy > busyMax)
+			busyMax = busy;
+	}
+
+	printf("chords: %d changes, %.0fms per chord\n", changes, hold/1e6);
+	printf("  longest pollIO   %.3fms\n", longestPoll/1e6);
+	printf("  MIDI bytes       %lu (%.1f per chord change)\n", sim.txBytes, (double)sim.txBytes / changes);
+	printf("  change to idle   avg %.3fms max %.3fms\n", busySum/1e6/changes, busyMax/1e6);
+	printf("  chord cache      %u hits, %u misses\n", chordCacheHits, chordCacheMisses);
+}
+
+////////////////////////////////////////////////////////////
+// CALIBRATE SCENARIO
+// Run the settle time calibration (MODE + row 1 column 2),
+// dragging the stylus over every string and pressing a
+// button in every column, then show the resulting table
+static void scenarioCalibrate()
+{
+	SIM_TIME t = sim.now + SIM_MS(50);
+	int i;
+
+	simInput(t, 0, 1<<1, 0, 0, 1, TAG_NONE);
+	t += SIM_MS(20);
+	simInput(t, 0, 0, 0, 0, 1, TAG_NONE);
+	t += SIM_MS(20);
+	simInput(t, 0, 0, 0, 0, 0, TAG_NONE);
+	t += SIM_MS(50);
+	for(i=0; i<16; ++i)
+	{
+		simInput(t, 1<<i, 0, 0, 0, 0, TAG_NONE);
+		t += SIM_MS(60);
+		simInput(t, 0, 0, 0, 0, 0, TAG_NONE);
+		t += SIM_MS(20);
+	}
+	for(i=0; i<16; ++i)
+	{
+		unsigned int keys[3] = {0, 0, 0};
+		keys[i%3] = 1<<i;
+		simInput(t, 0, keys[0], keys[1], keys[2], 0, TAG_NONE);
+		t += SIM_MS(60);
+		simInput(t, 0, 0, 0, 0, 0, TAG_NONE);
+		t += SIM_MS(20);
+	}
+	simInput(t, 0, 0, 0, 0, 1, TAG_NONE);
+	t += SIM_MS(50);
+	simInput(t, 0, 0, 0, 0, 0, TAG_NONE);
+	t += SIM_MS(300);
+	runUntil(t);
+	longestPoll = 0;	// calibration blocks the main loop
+
+	printf("calibrate: settle times (us)\n  string");
+	for(i=0; i<16; ++i)
+		printf(" %3d", (stringSettle[i]+1)*2);
+	printf("\n  keys  ");
+	for(i=0; i<16; ++i)
+		printf(" %3d", (keySettle[i]+1)*2);
+	printf("\n");
+}
+
+////////////////////////////////////////////////////////////
+// SETTINGS SCENARIO
+// Select a preset patch and store it as preset 1 with MODE
+// held, then start strumming straight away. The LED feedback and the
+// EEPROM writes must not hold up the scan. Then power
+// cycle and check the patch comes back
+static void scenarioSettings()
+{
+	SIM_TIME t = sim.now + SIM_MS(50);
+	unsigned long writes = sim.eepromWrites;
+	unsigned int saved;
+
+	simInput(t, 0, 1<<0, 0, 0, 1, TAG_NONE);	// row 1 column 1
+	t += SIM_MS(20);
+	simInput(t, 0, 0, 0, 0, 1, TAG_NONE);
+	t += SIM_MS(20);
+	simInput(t, 0, 0, 1<<11, 0, 1, TAG_NONE);	// row 2 column 12
+	t += SIM_MS(20);
+	simInput(t, 0, 0, 0, 0, 1, TAG_NONE);
+	t += SIM_MS(20);
+	simInput(t, 1<<0, 0, 0, 0, 1, TAG_NONE);	// preset 1
+	t += SIM_MS(20);
+	simInput(t, 0, 0, 0, 0, 0, TAG_NONE);
+	t += SIM_MS(100);
+	runUntil(t);
+	saved = options;
+
+	printf("settings: preset patch then store\n");
+	printf("  longest pollIO   %.3fms\n", longestPoll/1e6);
+	printf("  EEPROM writes    %lu\n", sim.eepromWrites - writes);
+
+	// power cycle, keeping the EEPROM
+	options = 0;
+	startup();
+	printf("  after power on   %s\n", options == saved? "patch restored" : "PATCH LOST");
+}
+
+////////////////////////////////////////////////////////////
+// SCALES SCENARIO
+// Select the blues scale from the scale bank (MODE + row 1
+// column 9, then string 11), hold F and check the strings
+// are mapped to it. Then power cycle and check the scale is
+// still selected, and that column 13 maps it from C
+static void scenarioScales()
+{
+	static const int blues[] = { 0, 3, 5, 6, 7, 10 };
+	SIM_TIME t = sim.now + SIM_MS(50);
+	unsigned char expect[16];
+	int i, s, wrong;
+
+	simInput(t, 0, 1<<8, 0, 0, 1, TAG_NONE);
+	t += SIM_MS(20);
+	simInput(t, 0, 0, 0, 0, 1, TAG_NONE);
+	t += SIM_MS(20);
+	simInput(t, 1<<10, 0, 0, 0, 1, TAG_NONE);
+	t += SIM_MS(20);
+	simInput(t, 0, 0, 0, 0, 0, TAG_NONE);
+	t += SIM_MS(50);
+	simInput(t, 0, 1<<5, 0, 0, 0, TAG_CHORD);
+	t += SIM_MS(100);
+	runUntil(t);
+
+	memset(expect, 0xff, sizeof(expect));
+	for(s=0; s<16; ++s)
+		for(i=0; i<(int)(sizeof(blues)/sizeof(blues[0])); ++i)
+			if((48 + s - 5) % 12 == blues[i])
+				expect[s] = 48 + s;
+	wrong = memcmp(playStrings.notes, expect, 16);
+
+	printf("scales: F blues from the scale bank\n");
+	printf("  strings         ");
+	for(s=0; s<16; ++s)
+		printf(playStrings.notes[s] == 0xff? "  -" : " %2d", playStrings.notes[s]);
+	printf("\n");
+	printf("  mapping          %s\n", wrong? "WRONG" : "ok");
+
+
+	// power cycle, keeping the EEPROM
+	settings = 0;
+	t = sim.now + SIM_MS(50);
+	startup();
+	simInput(t, 0, 0, 0, 0, 0, TAG_NONE);
+	t += SIM_MS(50);
+	simInput(t, 0, 1<<5, 0, 0, 0, TAG_CHORD);
+	t += SIM_MS(100);
+	runUntil(t);
+	printf("  after power on   %s\n", memcmp(playStrings.notes, expect, 16)? "SCALE LOST" : "scale restored");
+
+	// column 13 has the scale of column 1, C
+	simInput(t, 0, 1<<12, 0, 0, 0, TAG_CHORD);
+	t += SIM_MS(100);
+	runUntil(t);
+	memset(expect, 0xff, sizeof(expect));
+	for(s=0; s<16; ++s)
+		for(i=0; i<(int)(sizeof(blues)/sizeof(blues[0])); ++i)
+			if((48 + s) % 12 == blues[i])
+				expect[s] = 48 + s;
+	printf("  column 13        %s\n", memcmp(playStrings.notes, expect, 16)? "WRONG" : "ok");
+}
+
+////////////////////////////////////////////////////////////
+// PRESETS SCENARIO
+// Start from EEPROM as the original firmware left it, and check
+// the settings are carried over. Store two setups as presets
+// 2 and 5 (MODE + row 2 column 12, then the string), then
+// recall preset 2 (MODE + row 1 column 12) while the drone
+// is sounding, and time it. Damage preset 5 and check it is turned down,
+// as is the empty preset 7. Finally store twice before the
+// first is written, which must turn the second down, and
+// recall while it is being written, which must wait for each
+// byte's write cycle before reading
+#define PRESETS			72
+#define PRESET_SIZE		11
+
+// MODE + a button, then a string, then let go of MODE
+static SIM_TIME modeString(SIM_TIME t, unsigned int keys1, unsigned int keys2, int string)
+{
+	simInput(t, 0, keys1, keys2, 0, 1, TAG_NONE);
+	t += SIM_MS(20);
+	simInput(t, 0, 0, 0, 0, 1, TAG_NONE);
+	t += SIM_MS(20);
+	if(string >= 0)
+	{
+		simInput(t, 1<<string, 0, 0, 0, 1, TAG_NONE);
+		t += SIM_MS(20);
+		simInput(t, 0, 0, 0, 0, 1, TAG_NONE);
+		t += SIM_MS(20);
+	}
+	simInput(t, 0, 0, 0, 0, 0, TAG_NONE);
+	return t + SIM_MS(20);
+}
+
+static void scenarioPresets()
+{
+	static const unsigned char old[8] = { 154, 0x00, 0x00, 0x00, 0x00, 2, 9, 3 };
+	SIM_TIME t, recall, applied;
+	unsigned int optionsA, optionsB;
+	unsigned char channelA, velocityA;
+	unsigned long writes;
+
+	// an upgraded unit: the original firmware's settings, with
+	// the play channel 3 and drone octave 3
+	memset(sim.eeprom, 0xff, sizeof(sim.eeprom));
+	memcpy(sim.eeprom, old, 8);
+	sim.eeprom[1] = patch_GuitarStrum >> 8;
+	sim.eeprom[2] = patch_GuitarStrum & 0xff;
+	startup();
+	printf("presets: store, recall and damaged records\n");
+	printf("  original layout  %s\n", (options == patch_GuitarStrum && playChannel == 2 && droneOctave == 3)?
+		"settings carried over" : "SETTINGS LOST");
+
+	// A: guitar strum on channel 3 at velocity from string 8
+	t = sim.now + SIM_MS(50);
+	t = modeString(t, 0, 1<<9, 2);			// play channel, string 3
+	t = modeString(t, 0, 0, 7);				// velocity, string 8
+	t = modeString(t, 0, 1<<11, 1);			// store preset 2
+	runUntil(t);
+	optionsA = options;
+	channelA = playChannel;
+	velocityA = playVelocity;
+
+	// B: organ on channel 5
+	t = modeString(t, 1<<5, 0, -1);			// organ patch
+	t = modeString(t, 0, 1<<9, 4);			// play channel, string 5
+	t = modeString(t, 0, 1<<11, 4);			// store preset 5
+	t += SIM_MS(100);
+	runUntil(t);
+	optionsB = options;
+
+	// hold C, which starts the drone, then recall A
+	simInput(t, 0, 1<<0, 0, 0, 0, TAG_CHORD);
+	t += SIM_MS(100);
+	runUntil(t);
+	writes = sim.eepromWrites;
+	longestPoll = 0;
+	simInput(t, 0, 0, 0, 0, 1, TAG_NONE);
+	t += SIM_MS(20);
+	simInput(t, 0, 1<<11, 0, 0, 1, TAG_NONE);
+	t += SIM_MS(20);
+	simInput(t, 0, 0, 0, 0, 1, TAG_NONE);
+	t += SIM_MS(20);
+	recall = t;
+	simInput(t, 1<<1, 0, 0, 0, 1, TAG_NONE);	// preset 2
+	runUntil(t);
+	while(options != optionsA && sim.now < t + SIM_MS(100))
+		runUntil(sim.now + SIM_US(10));
+	applied = sim.now;
+	t += SIM_MS(20);
+	simInput(t, 0, 0, 0, 0, 1, TAG_NONE);
+	t += SIM_MS(20);
+	simInput(t, 0, 0, 0, 0, 0, TAG_NONE);
+	t += SIM_MS(100);
+	runUntil(t);
+
+	printf("  recall           %s %.3fms after the string, longest pollIO %.3fms\n",
+		(options == optionsA && playChannel == channelA && playVelocity == velocityA)? "ok" : "WRONG",
+		(applied - recall)/1e6, longestPoll/1e6);
+	printf("  EEPROM writes    %lu\n", sim.eepromWrites - writes);
+
+	// damage preset 5, then try it and the empty preset 7
+	sim.eeprom[PRESETS + 4*PRESET_SIZE + 3] ^= 0x10;
+	t = modeString(t, 1<<11, 0, 4);
+	t = modeString(t, 1<<11, 0, 6);
+	runUntil(t);
+	printf("  damaged, empty   %s\n", (options == optionsA && options != optionsB && playChannel == channelA)?
+		"turned down" : "LOADED");
+
+	// power cycle, keeping the EEPROM
+	options = 0;
+	playChannel = 0;
+	startup();
+	printf("  after power on   %s\n", (options == optionsA && playChannel == channelA)? "preset restored" : "PRESET LOST");
+
+	// two stores in one pass of the main loop go to presets 7 and 8
+	t = sim.now + SIM_MS(50);
+	runUntil(t);
+	storePreset(6);
+	storePreset(7);
+	runUntil(sim.now + SIM_MS(10));
+	recallPreset(0);
+	t += SIM_MS(200);
+	runUntil(t);
+	printf("  second store     %s\n", (sim.eeprom[PRESETS + 6*PRESET_SIZE] != 0xff && sim.eeprom[PRESETS + 7*PRESET_SIZE] == 0xff)?
+		"turned down" : "WRONG");
+}
+
+////////////////////////////////////////////////////////////
+// PANIC SCENARIO
+// Hold a chord with the drone on, strum it, then hit MIDI
+// panic (MODE + row 3 column 12) and time how long the link
+// is tied up
+static void scenarioPanic()
+{
+	SIM_TIME t = sim.now + SIM_MS(50);
+	SIM_TIME panic, last;
+	unsigned long bytes0;
+	int i;
+
+	options = patch_OrganButtons;
+	simInput(t, 0, 1, 0, 0, 0, TAG_NONE);
+	t += SIM_MS(100);
+	for(i=0; i<16; ++i)
+	{
+		simInput(t, 1<<i, 1, 0, 0, 0, TAG_NONE);
+		t += SIM_MS(5);
+		simInput(t, 0, 1, 0, 0, 0, TAG_NONE);
+		t += SIM_MS(5);
+	}
+	t += SIM_MS(100);
+	panic = t;
+	simInput(t, 0, 0, 0, 1<<11, 1, TAG_NONE);
+	t += SIM_MS(20);
+	simInput(t, 0, 0, 0, 0, 0, TAG_NONE);
+	runUntil(panic);
+	bytes0 = sim.txBytes;
+	t += SIM_MS(2000);
+	runUntil(t);
+
+	last = panic;
+	for(i=0; i<sim.midiLen; ++i)
+		if(sim.midi[i].start >= panic)
+			last = sim.midi[i].end;
+	printf("panic: organ patch, chord held and strummed\n");
+	printf("  MIDI bytes       %lu\n", sim.txBytes - bytes0);
+	printf("  panic to idle    %.3fms\n", (last - panic)/1e6);
+}
+
+////////////////////////////////////////////////////////////
+// CHANNELS SCENARIO
+// Organ patch with C held, so the drone is sounding. Move the
+// play channel onto the drone channel and change to F, then
+// move the drone channel off again and change to G. After each
+// change only notes of the new chord may be left sounding
+
+// notes sounding on the wire whose pitch class is not in mask
+static int strayNotes(unsigned int mask)
+{
+	static unsigned char on[16][128];
+	int i, c, n, stray = 0;
+	memset(on, 0, sizeof(on));
+	for(i=0; i<sim.midiLen; ++i)
+	{
+		SIM_MIDI *p = &sim.midi[i];
+		if((p->status & 0xe0) == 0x80)
+			on[p->status & 0x0f][p->data[0]] = ((p->status & 0xf0) == 0x90 && p->data[1]);
+	}
+	for(c=0; c<16; ++c)
+		for(n=0; n<128; ++n)
+			if(on[c][n] && !(mask & (1 << (n % 12))))
+				++stray;
+	return stray;
+}
+
+static void scenarioChannels()
+{
+	SIM_TIME t = sim.now + SIM_MS(50);
+	int stray;
+
+	options = patch_OrganButtons;
+	simInput(t, 0, 1<<0, 0, 0, 0, TAG_NONE);		// C
+	t += SIM_MS(100);
+	runUntil(t);
+	setPlayChannel(droneChannel);
+	simInput(t, 0, 1<<5, 0, 0, 0, TAG_NONE);		// F
+	t += SIM_MS(100);
+	simInput(t, 0, 0, 0, 0, 0, TAG_NONE);
+	t += SIM_MS(100);
+	runUntil(t);
+	stray = strayNotes(0x0221);
+	printf("channels: organ patch, drone moved under the play channel\n");
+	printf("  shared channel   %d stray notes after C to F%s\n", stray, stray? " HANGING" : "");
+
+	setDroneChannel(droneChannel + 1);
+	simInput(t, 0, 1<<7, 0, 0, 0, TAG_NONE);		// G
+	t += SIM_MS(100);
+	simInput(t, 0, 0, 0, 0, 0, TAG_NONE);
+	t += SIM_MS(100);
+	runUntil(t);
+	stray = strayNotes(0x0884);
+	printf("  split again      %d stray notes after F to G%s\n", stray, stray? " HANGING" : "");
+}
+
+////////////////////////////////////////////////////////////
+// DYNAMICS SCENARIO
+// Select the linear velocity curve (MODE + row 2 column 7)
+// then strum down across all strings at a range of speeds
+// and report the velocity each speed plays at
+static void scenarioDynamics()
+{
+	static const int speeds[] = { 500, 1000, 2000, 4000, 8000, 16000, 32000 };
+	SIM_TIME t = sim.now + SIM_MS(50);
+	int i, s, n, sum;
+
+	simInput(t, 0, 0, 1<<6, 0, 1, TAG_NONE);
+	t += SIM_MS(20);
+	simInput(t, 0, 0, 0, 0, 0, TAG_NONE);
+	t += SIM_MS(50);
+	simInput(t, 0, 1, 0, 0, 0, TAG_NONE);
+	t += SIM_MS(100);
+	runUntil(t);
+
+	printf("dynamics: velocity curve %d, downstrokes\n", (settings >> 2) & 3);
+	for(i=0; i<(int)(sizeof(speeds)/sizeof(speeds[0])); ++i)
+	{
+		SIM_TIME start = t;
+		for(s=0; s<16; ++s)
+		{
+			simInput(t, 1<<s, 1, 0, 0, 0, TAG_NONE);
+			t += SIM_US(speeds[i]);
+		}
+		simInput(t, 0, 1, 0, 0, 0, TAG_NONE);
+		t += SIM_MS(300);
+		runUntil(t);
+
+		// skip the first string, which carries over the last strum
+		n = sum = 0;
+		for(s=0; s<sim.midiLen; ++s)
+		{
+			SIM_MIDI *p = &sim.midi[s];
+			if(p->start >= start && (p->status & 0xf0) == 0x90 && p->data[1] && n++)
+				sum += p->data[1];
+		}
+		printf("  %6.1fms/string  %2d notes  velocity %5.1f\n", speeds[i]/1e3, n, n > 1? sum/(double)(n-1) : 0.0);
+	}
+}
+
+////////////////////////////////////////////////////////////
+// Find the last stats dump message of a type (and histogram,
+// for type 1) in the SysEx log, NULL if there is none. SysEx
+// data bytes are below 0x80, so F0 only starts a message
+static unsigned char *findStats(int type, int hist)
+{
+	unsigned char *found = NULL;
+	int i;
+	for(i=0; i+8 < sim.sysexLogLen; ++i)
+	{
+		unsigned char *p = &sim.sysexLog[i];
+		if(p[0] == 0xf0 && p[1] == 0x7d && p[2] == 0x4c && p[3] == 0x53 && p[4] == type && (type != 1 || p[5] == hist))
+			found = p;
+	}
+	return found;
+}
+
+// Bytes lost from MIDI in, added up over every stats dump,
+// -1 if there has not been one
+static int statsDropped()
+{
+	int i, total = -1;
+	for(i=0; i+8 < sim.sysexLogLen; ++i)
+	{
+		unsigned char *p = &sim.sysexLog[i];
+		if(p[0] == 0xf0 && p[1] == 0x7d && p[2] == 0x4c && p[3] == 0x53 && p[4] == 0x03)
+			total = (total < 0? 0 : total) + (p[5] | p[6]<<7 | p[7]<<14);
+	}
+	return total;
+}
+
+////////////////////////////////////////////////////////////
+// STATS SCENARIO
+// After some strumming and chord changes, ask for the
+// performance histograms (MODE + row 1 column 4) and decode
+// the SysEx dump
+static void scenarioStats()
+{
+	static const char *names[] = { "scan period", "poll time", "latency", "chord change", "TX depth" };
+	SIM_TIME t;
+	unsigned char *p;
+	unsigned int overflows;
+	int i, j, hists, buckets;
+
+	t = sim.now + SIM_MS(50);
+	for(i=0; i<(int)PROGRESSION_LEN; ++i)
+	{
+		unsigned int keys[3] = { 0, 0, 0 };
+		keys[progression[i].row] = 1<<progression[i].column;
+		simInput(t, 0, keys[0], keys[1], keys[2], 0, TAG_CHORD + i);
+		t += SIM_MS(50);
+		for(j=0; j<16; ++j)
+		{
+			simInput(t, 1<<j, keys[0], keys[1], keys[2], 0, TAG_MAKE + j);
+			t += SIM_MS(3);
+		}
+		simInput(t, 0, keys[0], keys[1], keys[2], 0, TAG_NONE);
+		t += SIM_MS(100);
+	}
+	runUntil(t);
+
+	// the dump must not hold up the main loop
+	longestPoll = 0;
+	overflows = txOverflows;
+	simInput(t, 0, 1<<3, 0, 0, 1, TAG_NONE);
+	t += SIM_MS(20);
+	simInput(t, 0, 0, 0, 0, 0, TAG_NONE);
+	t += SIM_MS(100);
+	runUntil(t);
+
+	printf("stats: %d chords strummed then SysEx dump\n", (int)PROGRESSION_LEN);
+	p = findStats(1, 0);
+	if(!p || statsDropped() < 0)
+	{
+		printf("  NO STATS DUMP\n");
+		return;
+	}
+	hists = p[6];
+	buckets = p[7];
+	printf("  SysEx            %d messages, %d bytes\n", hists + 1, sim.sysexLogLen);
+	printf("  during the dump  longest pollIO %.3fms, %u TX overflows\n", longestPoll/1e6, txOverflows - overflows);
+	printf("  bucket          ");
+	for(j=0; j<buckets; ++j)
+		printf(" %3d", j);
+	printf("\n");
+	for(i=0; i<hists; ++i)
+	{
+		printf("  %-16s", i < (int)(sizeof(names)/sizeof(names[0]))? names[i] : "?");
+		p = findStats(1, i);
+		for(j=0; j<buckets; ++j)
+			printf(p? " %3d" : "   -", p? p[8 + j] : 0);
+		printf("\n");
+	}
+	printf("  MIDI in dropped  %d bytes\n", statsDropped());
+}
+
+////////////////////////////////////////////////////////////
+// PERFORM SCENARIO
+// Strum down and up through the chord progression, changing
+// chord part way through the last strum on each chord. Run
+// it on the SCAN_TRACE build (strumsim-trace) with -r to make
+// a sample trace for strumreplay
+static void scenarioPerform(SIM_TIME perString, int cycles)
+{
+	SIM_TIME t = sim.now + SIM_MS(50);
+	int n, i, j, s;
+
+	for(n=0; n<cycles; ++n)
+	{
+		for(i=0; i<(int)PROGRESSION_LEN; ++i)
+		{
+			unsigned int keys[3] = { 0, 0, 0 };
+			keys[progression[i].row] = 1<<progression[i].column;
+			simInput(t, 0, keys[0], keys[1], keys[2], 0, TAG_CHORD + i);
+			t += SIM_MS(30);
+			for(j=0; j<4; ++j)
+			{
+				for(s=0; s<16; ++s)
+				{
+					int string = (j&1)? 15-s : s;
+					if(j == 3 && s == 8)
+					{
+						// next chord comes in mid strum
+						int next = (i+1) % PROGRESSION_LEN;
+						memset(keys, 0, sizeof(keys));
+						keys[progression[next].row] = 1<<progression[next].column;
+					}
+					simInput(t, 1<<string, keys[0], keys[1], keys[2], 0, TAG_MAKE + string);
+					t += perString;
+				}
+				simInput(t, 0, keys[0], keys[1], keys[2], 0, TAG_NONE);
+				t += SIM_MS(60);
+			}
+		}
+	}
+	simInput(t, 0, 0, 0, 0, 0, TAG_NONE);
+	t += SIM_MS(500);
+	runUntil(t);
+
+	printf("perform: %d times round %d chords, %.3fms per string\n", cycles, (int)PROGRESSION_LEN, perString/1e6);
+	printf("  longest pollIO   %.3fms\n", longestPoll/1e6);
+	printf("  MIDI bytes       %lu\n", sim.txBytes);
+}
+
+////////////////////////////////////////////////////////////
+// BURST SCENARIO
+// Change chord and pluck a string straight after, while the
+// MIDI for the chord change is still going out, and time how
+// long the plucked note waits
+static void scenarioBurst(int cycles)
+{
+	SIM_TIME t = sim.now + SIM_MS(50);
+	SIM_TIME pluck[64], lat, latMin = ~0ULL, latMax = 0, latSum = 0;
+	int n, i, j, count = 0, found = 0;
+
+	for(n=0; n<cycles; ++n)
+	{
+		for(i=0; i<(int)PROGRESSION_LEN && count < 64; ++i)
+		{
+			unsigned int keys[3] = { 0, 0, 0 };
+			keys[progression[i].row] = 1<<progression[i].column;
+			simInput(t, 1<<3, keys[0], keys[1], keys[2], 0, TAG_CHORD + i);
+			simInput(t + SIM_MS(8), 0, keys[0], keys[1], keys[2], 0, TAG_BREAK + 3);
+			pluck[count++] = t + SIM_MS(8);
+			t += SIM_MS(300);
+		}
+	}
+	simInput(t, 0, 0, 0, 0, 0, TAG_NONE);
+	t += SIM_MS(300);
+	runUntil(t);
+
+	// first note on the play channel after each pluck
+	for(i=0; i<count; ++i)
+	{
+		for(j=0; j<sim.midiLen; ++j)
+		{
+			SIM_MIDI *p = &sim.midi[j];
+			if(p->start >= pluck[i] && p->status == (0x90 | playChannel) && p->data[1])
+			{
+				lat = p->end - pluck[i];
+				if(lat < latMin) latMin = lat;
+				if(lat > latMax) latMax = lat;
+				latSum += lat;
+				++found;
+				break;
+			}
+		}
+	}
+	printf("burst: %d chord changes, string plucked 8ms after each\n", count);
+	printf("  MIDI bytes       %lu\n", sim.txBytes);
+	printf("  notes            %d of %d plucks\n", found, count);
+	if(found)
+		printf("  pluck to note    min %.3fms avg %.3fms max %.3fms\n", latMin/1e6, latSum/1e6/found, latMax/1e6);
+}
+
+////////////////////////////////////////////////////////////
+////////////////////////////////////////////////////////////
+// GLITCH SCENARIO
+// Hold a chord in column 6 while other buttons around it read
+// as pressed for 2.5ms at a time, as a bouncing or bridged 
+// contact might. None of them should change the chord
+static void scenarioGlitch()
+{
+	SIM_TIME t = sim.now + SIM_MS(50);
+	SIM_TIME start;
+	int i, changes = 0;
+
+	simInput(t, 0, 1<<5, 0, 0, 0, TAG_CHORD);
+	t += SIM_MS(100);
+	start = t;
+	for(i=0; i<32; ++i)
+	{
+		unsigned int keys[3] = { 1<<5, 0, 0 };
+		keys[i%3] |= 1<<(i%8);
+		simInput(t, 0, keys[0], keys[1], keys[2], 0, TAG_NONE);
+		simInput(t + SIM_US(2500), 0, 1<<5, 0, 0, 0, TAG_NONE);
+		t += SIM_MS(50) + SIM_US(300*i);
+	}
+	t += SIM_MS(100);
+	runUntil(t);
+
+	for(i=0; i<sim.midiLen; ++i)
+		if(sim.midi[i].start >= start && (sim.midi[i].status & 0xf0) == 0x90)
+			++changes;
+	printf("glitch: 32 button glitches of 2.5ms while a chord is held\n");
+	printf("  note messages    %d\n", changes);
+}
+
+////////////////////////////////////////////////////////////
+// ARP SCENARIO
+// Set the arpeggiator rate (MODE + row 1 column 7, then
+// string 10), hold C and then Am, and check the step and note
+// lengths, that the notes come from the chord held, and that
+// the scan keeps its rate
+static void scenarioArp()
+{
+	static const int chords[2][3] = { { 0, 4, 7 }, { 9, 0, 4 } };
+	SIM_TIME t = sim.now + SIM_MS(50);
+	SIM_TIME change, end, last = 0, step, stepMin = ~0ULL, stepMax = 0, stepSum = 0, gate, gateMax = 0, gateSum = 0;
+	int i, j, c, ons = 0, steps = 0, offs = 0, inChord = 0, hanging = 0;
+
+	simInput(t, 0, 1<<6, 0, 0, 1, TAG_NONE);
+	t += SIM_MS(20);
+	simInput(t, 0, 0, 0, 0, 1, TAG_NONE);
+	t += SIM_MS(20);
+	simInput(t, 1<<9, 0, 0, 0, 1, TAG_NONE);
+	t += SIM_MS(20);
+	simInput(t, 0, 0, 0, 0, 0, TAG_NONE);
+	t += SIM_MS(50);
+	simInput(t, 0, 1<<0, 0, 0, 0, TAG_CHORD);
+	t += SIM_MS(1000);
+	change = t;
+	simInput(t, 0, 0, 1<<9, 0, 0, TAG_CHORD + 1);
+	t += SIM_MS(1000);
+	end = t;
+	simInput(t, 0, 0, 0, 0, 0, TAG_NONE);
+	t += SIM_MS(300);
+	runUntil(t);
+
+	for(i=0; i<sim.midiLen; ++i)
+	{
+		SIM_MIDI *p = &sim.midi[i];
+		if(p->status != (0x90 | playChannel) || !p->data[1])
+			continue;
+		++ons;
+		if(last)
+		{
+			step = p->start - last;
+			if(step < stepMin) stepMin = step;
+			if(step > stepMax) stepMax = step;
+			stepSum += step;
+			++steps;
+		}
+		last = p->start;
+		c = p->start >= change;
+		for(j=0; j<3; ++j)
+			if(p->data[0] % 12 == chords[c][j])
+				break;
+		inChord += (j < 3 && p->start < end);
+
+		// its note off
+		for(j=i+1; j<sim.midiLen; ++j)
+			if(sim.midi[j].status == p->status && sim.midi[j].data[0] == p->data[0])
+				break;
+		if(j == sim.midiLen || sim.midi[j].data[1])
+		{
+			++hanging;
+			continue;
+		}
+		gate = sim.midi[j].start - p->start;
+		if(gate > gateMax) gateMax = gate;
+		gateSum += gate;
+		++offs;
+	}
+
+	printf("arp: rate from string 10, C held for 1s then Am for 1s\n");
+	printf("  scan rate        %u scans/s, %u overruns\n", scansPerSecond, scanOverruns);
+	printf("  longest pollIO   %.3fms\n", longestPoll/1e6);
+	printf("  notes            %d, %d from the chord held, %d left sounding\n", ons, inChord, hanging);
+	if(steps)
+		printf("  step             min %.3fms avg %.3fms max %.3fms\n", stepMin/1e6, stepSum/1e6/steps, stepMax/1e6);
+	if(offs)
+		printf("  note length      avg %.3fms max %.3fms\n", gateSum/1e6/offs, gateMax/1e6);
+	printf("  events           %u not posted\n", eventOverflows);
+}
+
+////////////////////////////////////////////////////////////
+// THRU SCENARIO
+// Play messages into MIDI in on channel 16 while strumming,
+// with running status, clock bytes in the middle of messages,
+// a SysEx and one that stops part way. Check that they all
+// come out in order and how long each waited to be merged.
+// Then keep MIDI in busy through a stats dump, with some bad
+// bytes among it, and check the count of dropped bytes the
+// dumps report
+#define THRU_CHANNEL	0x0f
+#define THRU_MAX		4096
+
+static struct {
+	SIM_TIME end;			// last byte in
+	unsigned char status;
+	unsigned char data[2];
+	int len;				// bytes as passed on, including status
+	int dump;				// played during the stats dump
+	int sent;
+} thru[THRU_MAX];
+static int thruLen = 0;
+static int thruDump = 0;
+static unsigned char thruRunning = 0;	// running status at MIDI in
+
+static SIM_TIME thruMessage(SIM_TIME t, unsigned char status, unsigned char d1, unsigned char d2, int clock)
+{
+	unsigned char bytes[5];
+	int n = 0, len = 2;
+
+	if((status & 0xe0) == 0xc0)
+		len = 1;
+	if(status != thruRunning)
+		bytes[n++] = status;
+	thruRunning = (status < 0xf0)? status : 0;
+	bytes[n++] = d1;
+	if(clock)
+		bytes[n++] = 0xf8;
+	if(len > 1)
+		bytes[n++] = d2;
+	t = simMidiIn(t, bytes, n);
+
+	if(thruLen + 2 > THRU_MAX)
+	{
+		fprintf(stderr, "thru: too many messages\n");
+		exit(1);
+	}
+	if(clock)
+	{
+		thru[thruLen].end = t - SIM_MIDI_BYTE_NS*(len > 1);
+		thru[thruLen].status = 0xf8;
+		thru[thruLen].len = 1;
+		thru[thruLen].dump = thruDump;
+		++thruLen;
+	}
+	thru[thruLen].end = t;
+	thru[thruLen].status = status;
+	thru[thruLen].data[0] = d1;
+	thru[thruLen].data[1] = (len > 1)? d2 : 0;
+	thru[thruLen].len = 1 + len;
+	thru[thruLen].dump = thruDump;
+	++thruLen;
+	return t;
+}
+
+static int isThru(SIM_MIDI *p)
+{
+	return p->status == 0xf8 || p->status == 0xf2 || (p->status < 0xf0 && (p->status & 0x0f) == THRU_CHANNEL);
+}
+
+// Match what came out with what went in, in order, taking 
+// realtime and other messages separately since realtime may
+// overtake
+static void matchThru(int realtime)
+{
+	int i, j = 0;
+	for(i=0; i<thruLen; ++i)
+	{
+		if((thru[i].status == 0xf8) != realtime)
+			continue;
+		while(j < sim.midiLen && (!isThru(&sim.midi[j]) || (sim.midi[j].status == 0xf8) != realtime))
+			++j;
+		if(j < sim.midiLen && sim.midi[j].status == thru[i].status && 
+			sim.midi[j].data[0] == thru[i].data[0] && (thru[i].len < 3 || sim.midi[j].data[1] == thru[i].data[1]) &&
+			sim.midi[j].start >= thru[i].end)
+		{
+			thru[i].sent = 1;
+			thru[i].end = sim.midi[j].start - thru[i].end;	// now the latency
+			++j;
+		}
+	}
+}
+
+static void scenarioThru()
+{
+	static const unsigned char sysex[] = { 0xf0, 0x7d, 0x01, 0x10, 0x20, 0x30, 0x40, 0x50, 0x60, 0x70, 0x7f, 0xf7 };
+	static const unsigned char cutSysex[] = { 0xf0, 0x7d, 0x02, 0x11, 0x22, 0x33 };
+	SIM_TIME t, in, lat, latMax = 0, latSum = 0, rtMax = 0;
+	int i, j, k, count = 0, sent = 0, rt = 0, rtSent = 0, dropped = 0, droppedBytes = 0;
+	int sysexIn = 2, sysexOut = 0, sysexEnd = 0, own = 0, bad = 0, firmware;
+	unsigned char note = 36;
+
+	// strum through the progression
+	t = sim.now + SIM_MS(50);
+	for(i=0; i<(int)PROGRESSION_LEN; ++i)
+	{
+		unsigned int keys[3] = { 0, 0, 0 };
+		keys[progression[i].row] = 1<<progression[i].column;
+		simInput(t, 0, keys[0], keys[1], keys[2], 0, TAG_CHORD + i);
+		t += SIM_MS(50);
+		for(j=0; j<16; ++j)
+		{
+			simInput(t, 1<<j, keys[0], keys[1], keys[2], 0, TAG_MAKE + j);
+			t += SIM_MS(3);
+		}
+		simInput(t, 0, keys[0], keys[1], keys[2], 0, TAG_NONE);
+		t += SIM_MS(100);
+	}
+
+	// ..while notes come in every 3ms, with some other messages
+	in = sim.now + SIM_MS(60);
+	for(k=0; in < t; ++k)
+	{
+		if(k % 50 == 49)
+			thruMessage(in, 0xb0 | THRU_CHANNEL, 7, k & 0x7f, 0);
+		else if(k % 70 == 69)
+			thruMessage(in, 0xc0 | THRU_CHANNEL, k & 0x7f, 0, 0);
+		else if(k % 90 == 89)
+			thruMessage(in, 0xf2, k & 0x7f, 1, 0);
+		else if(k == 120)
+		{
+			simMidiIn(in, sysex, sizeof(sysex));
+			thruRunning = 0;
+		}
+		else
+		{
+			thruMessage(in, 0x90 | THRU_CHANNEL, note, (k&1)? 0 : 100, k % 13 == 0);
+			if(k&1)
+				note = 36 + (note - 35) % 48;
+		}
+		in += SIM_MS(3);
+	}
+
+	// a burst as fast as the line goes, then a SysEx that stops
+	// part way and more notes after it
+	for(k=0; k<48; ++k)
+		in = thruMessage(in, 0x90 | THRU_CHANNEL, 60 + k/2, (k&1)? 0 : 90, 0);
+	in = simMidiIn(in + SIM_MS(10), cutSysex, sizeof(cutSysex));
+	thruRunning = 0;
+	in += SIM_MS(300);
+	for(k=0; k<8; ++k)
+		in = thruMessage(in + SIM_MS(5), 0x80 | THRU_CHANNEL, 60 + k, 0, 0);
+	count = thruLen;
+
+	// stats dump with MIDI in running flat out from just after
+	// it starts, with bytes that have framing errors and data
+	// bytes with no status, then another one to read the count
+	t = in + SIM_MS(50);
+	simInput(t, 0, 1<<3, 0, 0, 1, TAG_NONE);
+	simInput(t + SIM_MS(20), 0, 0, 0, 0, 0, TAG_NONE);
+	thruDump = 1;
+	in = t + SIM_MS(10);
+	for(k=0; k<96; ++k)
+	{
+		if(k % 16 == 15)
+		{
+			in = simMidiInError(in);
+			++bad;
+		}
+		else if(k % 16 == 7)
+		{
+			unsigned char stray = 0x55;
+			in = thruMessage(in, 0xf2, k, 2, 0);
+			in = simMidiIn(in, &stray, 1);
+			++bad;
+		}
+		else
+			in = thruMessage(in, 0x90 | THRU_CHANNEL, k, 64, 0);
+	}
+	t = in + SIM_MS(200);
+	simInput(t, 0, 1<<3, 0, 0, 1, TAG_NONE);
+	simInput(t + SIM_MS(20), 0, 0, 0, 0, 0, TAG_NONE);
+	t += SIM_MS(200);
+	runUntil(t);
+	firmware = statsDropped();
+
+	matchThru(1);
+	matchThru(0);
+	for(i=0; i<thruLen; ++i)
+	{
+		lat = thru[i].end;
+		if(!thru[i].sent)
+		{
+			++dropped;
+			droppedBytes += thru[i].len;
+		}
+		else if(thru[i].status == 0xf8)
+		{
+			if(lat > rtMax) rtMax = lat;
+			++rtSent;
+		}
+		else if(!thru[i].dump)
+		{
+			if(lat > latMax) latMax = lat;
+			latSum += lat;
+			++sent;
+		}
+		if(thru[i].status == 0xf8 && !thru[i].dump)
+			++rt;
+	}
+	for(i=0; i<sim.midiLen; ++i)
+	{
+		SIM_MIDI *p = &sim.midi[i];
+		if((p->status & 0xf0) == 0x90 && (p->status & 0x0f) == playChannel && p->data[1])
+			++own;
+		else if(p->status == 0xf0)
+			++sysexOut;
+		else if(p->status == 0xf7)
+			++sysexEnd;
+	}
+
+	printf("thru: %d messages into MIDI in while strumming, %d during a stats dump\n", count - rt, thruLen - count);
+	printf("  merged           %d of %d in order, %d clocks of %d\n", sent, count - rt, rtSent, rt);
+	if(sent)
+		printf("  merge latency    avg %.3fms max %.3fms (a message takes %.3fms)\n", latSum/1e6/sent, latMax/1e6, 3*SIM_MIDI_BYTE_NS/1e6);
+	printf("  clock latency    max %.3fms\n", rtMax/1e6);
+	printf("  SysEx            %d in (1 cut short), %d started and %d ended, including 2 stats dumps\n", sysexIn, sysexOut, sysexEnd);
+	printf("  own note ons     %d\n", own);
+	printf("  dropped          %d messages, %d bytes and %d bad bytes (firmware counted %d, receiver lost %lu)\n", dropped, droppedBytes, bad, firmware, sim.rcLost);
+}
+
+////////////////////////////////////////////////////////////
+// CUTOFF SCENARIO
+// A SysEx comes in at MIDI in and stops part way, which holds
+// up all output. Strum fast enough to fill the string queue
+// while it does, then ask for a stats dump. The main loop has
+// to wait for queue space, and the interrupt must still time
+// out the SysEx so the output starts again
+static void scenarioCutoff()
+{
+	static const unsigned char cutSysex[] = { 0xf0, 0x7d, 0x02, 0x11, 0x22, 0x33 };
+	SIM_TIME t, cut, resumed = 0;
+	int i, j, notes = 0;
+
+	options = patch_BasicStrum;
+	t = sim.now + SIM_MS(50);
+	simInput(t, 0, 1<<0, 0, 0, 0, TAG_CHORD);
+	t += SIM_MS(50);
+	cut = simMidiIn(t, cutSysex, sizeof(cutSysex));
+	t = cut + SIM_MS(5);
+	for(i=0; i<8; ++i)
+	{
+		for(j=0; j<16; ++j)
+		{
+			int s = (i & 1)? 15 - j : j;
+			simInput(t, 1<<s, 1<<0, 0, 0, 0, TAG_MAKE + s);
+			t += SIM_US(500);
+		}
+	}
+	simInput(t, 0, 1<<0, 0, 0, 0, TAG_NONE);
+	t += SIM_MS(150);
+	simInput(t, 0, 1<<3, 0, 0, 1, TAG_NONE);	// stats dump
+	t += SIM_MS(20);
+	simInput(t, 0, 0, 0, 0, 0, TAG_NONE);
+	t += SIM_MS(500);
+
+	// a hang shows as the firmware running past the end
+	sim.limit = t + SIM_MS(1000);
+	runUntil(t);
+	sim.limit = 0;
+
+	for(i=0; i<sim.midiLen; ++i)
+	{
+		SIM_MIDI *p = &sim.midi[i];
+		if(p->start < cut || (p->status & 0xf0) != 0x90 || !p->data[1])
+			continue;
+		if(!resumed)
+			resumed = p->start;
+		++notes;
+	}
+	printf("cutoff: SysEx in stops part way, then a fast strum and a stats dump\n");
+	printf("  output resumed   %.3fms after the last byte in\n", resumed? (resumed - cut)/1e6 : -1.0);
+	printf("  notes            %d, %u scan overruns\n", notes, scanOverruns);
+	printf("  stats dump       %s\n", statsDropped() >= 0? "sent" : "MISSING");
+}
+
+////////////////////////////////////////////////////////////
+int main(int argc, char *argv[])
+{
+	const char *scenario = "strum";
+	const char *patch = NULL;
+	const char *raw = NULL;
+	SIM_TIME perString = SIM_US(2000);
+	int i;
+
+	for(i=1; i<argc; ++i)
+	{
+		if(!strcmp(argv[i], "-v"))
+			verbose = 1;
+		else if(!strcmp(argv[i], "-p") && i+1 < argc)
+			patch = argv[++i];
+		else if(!strcmp(argv[i], "-r") && i+1 < argc)
+			raw = argv[++i];
+		else if(!strcmp(argv[i], "-s") && i+1 < argc)
+			perString = SIM_US(atoi(argv[++i]));
+		else if(argv[i][0] != '-')
+			scenario = argv[i];
+		else
+		{
+			fprintf(stderr, "usage: strumsim [strum|chords|calibrate|settings|scales|presets|panic|channels|dynamics|stats|thru|cutoff|arp|perform|burst|glitch] [-p patch] [-s us-per-string] [-r raw-midi-file] [-v]\n");
+			return 1;
+		}
+	}
+
+	simReset();
+	if(raw && !(sim.rawOut = fopen(raw, "wb")))
+	{
+		perror(raw);
+		return 1;
+	}
+	startup();
+	if(patch)
+	{
+		for(i=0; patches[i].name; ++i)
+			if(!strcmp(patches[i].name, patch))
+				break;
+		if(!patches[i].name)
+		{
+			fprintf(stderr, "unknown patch %s\n", patch);
+			return 1;
+		}
+		options = *patches[i].options;
+	}
+
+	if(!strcmp(scenario, "strum"))
+		scenarioStrum(perString, 8);
+	else if(!strcmp(scenario, "calibrate"))
+	{
+		scenarioCalibrate();
+		scenarioStrum(perString, 8);
+	}
+	else if(!strcmp(scenario, "settings"))
+	{
+		scenarioSettings();
+		scenarioStrum(perString, 8);
+	}
+	else if(!strcmp(scenario, "scales"))
+		scenarioScales();
+	else if(!strcmp(scenario, "presets"))
+		scenarioPresets();
+	else if(!strcmp(scenario, "panic"))
+		scenarioPanic();
+	else if(!strcmp(scenario, "channels"))
+		scenarioChannels();
+	else if(!strcmp(scenario, "glitch"))
+		scenarioGlitch();
+	else if(!strcmp(scenario, "burst"))
+		scenarioBurst(2);
+	else if(!strcmp(scenario, "perform"))
+		scenarioPerform(perString, 2);
+	else if(!strcmp(scenario, "stats"))
+		scenarioStats();
+	else if(!strcmp(scenario, "thru"))
+		scenarioThru();
+	else if(!strcmp(scenario, "cutoff"))
+		scenarioCutoff();
+	else if(!strcmp(scenario, "arp"))
+		scenarioArp();
+	else if(!strcmp(scenario, "dynamics"))
+		scenarioDynamics();
+	else if(!strcmp(scenario, "chords"))
+		scenarioChords(SIM_MS(500), 4);
+	else
+	{
+		fprintf(stderr, "unknown scenario %s\n", scenario);
+		return 1;
+	}
+
+	printf("  TX buffer        high water %d bytes, %u overflows\n", txHighWater, txOverflows);
+	if(sim.sspBytes)
+		printf("  SPI              %lu bytes, %lu collisions\n", sim.sspBytes, sim.sspCollisions);
+	if(verbose)
+		dumpMidi();
+	if(sim.rawOut)
+		fclose(sim.rawOut);
+	return 0;
+}